@@ -3,35 +3,72 @@
 
 #include "common.h"
 #include <vector>
+#include <limits>
 #include <queue>
 #include "Particle.h"
 #include "ParticleComp.h"
 #include "OrientedBox.h"
 #include "MultipoleMoments.h"
+#include "KnnStore.h"
 
 struct CentroidData {
-  Vector3D<Real> moment;
-  MultipoleMoments multipoles;
-  Real sum_mass;
+  // Opening tests only read these, so they lead the struct
+  OrientedBox<Real> box;
+  Real rsq;                     ///< Opening radius
   Vector3D<Real> centroid; // too slow to compute this on the fly
-  Real max_rad = 0.0;
+  Real sum_mass;
+  int count;
+  int n_random = 0; // Particles of a random catalog, see CountVisitor
   Real size_sm;
+  Real max_rad = 0.0;
+  Vector3D<Real> moment;
+  MultipoleMoments multipoles;
+
+  // Per-particle search state, claimed from the PE's KnnStore the first
+  // time a search touches the leaf. Copies of the data never share it
   struct PerParticleStruct {
+    static constexpr size_t unclaimed = std::numeric_limits<size_t>::max();
     PerParticleStruct() {}
     PerParticleStruct& operator=(const PerParticleStruct&) {return *this;}
     PerParticleStruct(const PerParticleStruct&) {}
-    std::vector< CkVec<pqSmoothNode> > neighbors; // Neighbor list for knn search
-    std::vector<std::pair<Real, Particle>> best_dt;
+    KnnStore::Neighbors neighbors(int i) {
+      if (first_neighbor == unclaimed) first_neighbor = getStore().claimNeighbors(n_particles);
+      return store->getNeighbors(first_neighbor + i);
+    }
+    std::pair<Real, Particle>& best_dt(int i) {
+      if (first_best_dt == unclaimed) first_best_dt = getStore().claimBestDt(n_particles);
+      return store->getBestDt(first_best_dt + i);
+    }
+    KnnStore& getStore() {
+      if (!store) store = &KnnStore::local();
+      return *store;
+    }
+    int n_particles = 0;
+    KnnStore* store = nullptr;
+    Real max_ball_sq = std::numeric_limits<Real>::max(); // See NeighborSearch
+    size_t first_neighbor = unclaimed;
+    size_t first_best_dt = unclaimed;
   };
   PerParticleStruct pps;
-  OrientedBox<Real> box;
-  int count;
-  Real rsq;                     ///< Opening radius
+
+  // The fields opening tests read of a source, which LinearTree packs
+  struct Opening {
+    OrientedBox<Real> box;
+    Real rsq;
+    Vector3D<Real> centroid;
+    Real sum_mass;
+    int count;
+    int n_random;
+  };
+  Opening opening() const {
+    return {box, rsq, centroid, sum_mass, count, n_random};
+  }
+
   static constexpr const Real opening_geometry_factor_squared = 4.0 / 3.0;
   static constexpr const Real theta = 0.7;
 
   CentroidData() :
-  moment(Vector3D<Real> (0,0,0)), sum_mass(0), count(0), rsq(0.) {}
+  rsq(0.), sum_mass(0), count(0), moment(Vector3D<Real> (0,0,0)) {}
 
   /// Construct centroid from particles.
   CentroidData(const Particle* particles, int n_particles, int depth) : CentroidData() {
@@ -39,6 +76,7 @@ struct CentroidData {
       moment += particles[i].mass * particles[i].position;
       sum_mass += particles[i].mass;
       box.grow(particles[i].position);
+      n_random += particles[i].isRandom();
     }
     getRadius();
     centroid = moment / sum_mass;
@@ -91,14 +129,14 @@ struct CentroidData {
     multipoles += cd.multipoles;
     calculateRadiusFarthestCorner(multipoles, tmp_box);
     count += cd.count;
+    n_random += cd.n_random;
     return *this;
   }
 
   CentroidData& operator=(const CentroidData&) = default;
 
   void widen() {
-    pps.neighbors.resize(count);
-    pps.best_dt.resize(count, std::make_pair(std::numeric_limits<Real>::max(), Particle{}));
+    pps.n_particles = count;
   }
 
   void pup(PUP::er& p) {
@@ -108,6 +146,7 @@ struct CentroidData {
     p | centroid;
     p | box;
     p | count;
+    p | n_random;
     p | rsq;
     p | max_rad;
     p | size_sm;
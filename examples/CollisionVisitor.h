@@ -38,7 +38,8 @@ public:
 
 // in leaf check for not same particle plz
 public:
-  static bool open(const SpatialNode<CentroidData>& source, SpatialNode<CentroidData>& target) {
+  template <typename Source>
+  static bool open(const Source& source, SpatialNode<CentroidData>& target) {
     Real r_bucket = target.data.size_sm + target.data.max_rad;
     if (!Space::intersect(source.data.box, target.data.box.center(), r_bucket*r_bucket))
       return false;
@@ -63,8 +64,8 @@ public:
         Real rsq = tp.ball * tp.ball;
         if (dsq < rsq && sp.order != tp.order) {
           Real dt = getCollideTime(tp, sp);
-          if (dt < target.data.pps.best_dt[i].first) {
-            target.data.pps.best_dt[i] = std::make_pair(dt, sp);
+          if (dt < target.data.pps.best_dt(i).first) {
+            target.data.pps.best_dt(i) = std::make_pair(dt, sp);
           }
         }
       }
@@ -5,52 +5,90 @@
 #include "Vector3D.h"
 #include "paratreet.decl.h"
 
-#include <cstring>
+#include <algorithm>
 #include <cmath>
+#include <vector>
 
+// Pair counts in logarithmic distance bins, kept separately for pairs of
+// two data particles (DD), one data and one random (DR) and two randoms
+// (RR). Bins are found by comparing squared distances against squared bin
+// edges, so counting takes no sqrt or log.
 struct CountManager : public CBase_CountManager {
-  const double logmin;
-  const double logmax;
+  enum Kind {eDD = 0, eDR = 1, eRR = 2};
+  static constexpr int n_kinds = 3;
+
   const int nbins;
+  std::vector<Real> edges_sq; // nbins + 1 ascending edges
+  // For each kind, one slot below the first edge, nbins, and one at or
+  // past the last edge, so that binning needs no range check
+  std::vector<unsigned long long> slots;
+  std::vector<Real> scratch;
+
+  CountManager(double min, double max, int nbins) : nbins(nbins) {
+    for (int k = 0; k <= nbins; k++) {
+      double edge = min * std::pow(max / min, (double) k / nbins);
+      edges_sq.push_back(edge * edge);
+    }
+    slots.resize(n_kinds * (nbins + 2), 0);
+  }
 
-  int* bins;
+  Real edge(int k) const {return std::sqrt(edges_sq[k]);}
 
-  CountManager(double min, double max, int nbins) : logmin(std::log(min)), logmax(std::log(max)), nbins(nbins) {
-    bins = new int[nbins];
-    std::memset(bins, 0, nbins*sizeof(int));
+  // Contributes the DD, DR and RR bins in that order, then clears them
+  void sum(const CkCallback& cb) {
+    std::vector<unsigned long long> bins (n_kinds * nbins);
+    for (int kind = 0; kind < n_kinds; kind++) {
+      std::copy_n(&slots[kind * (nbins + 2) + 1], nbins, &bins[kind * nbins]);
+    }
+    std::fill(slots.begin(), slots.end(), 0);
+    contribute(bins.size() * sizeof(unsigned long long), bins.data(), CkReduction::sum_ulong_long, cb);
   }
 
-  ~CountManager() {
-    delete[] bins;
+  // Number of edges at or below dsq, written as a sum so that it vectorizes
+  int slot(Real dsq) const {
+    int s = 0;
+    for (int k = 0; k <= nbins; k++) s += dsq >= edges_sq[k];
+    return s;
   }
 
-  void sum(const CkCallback& cb) {
-    contribute(nbins*sizeof(int), bins, CkReduction::sum_int, cb);
+  void count(int kind, Real dsq) {
+    slots[kind * (nbins + 2) + slot(dsq)]++;
   }
 
-  void count(Real d) {
-    double logd = std::log(d);
-    if (logd >= logmin && logd < logmax) {
-      bins[int((logd-logmin)/(logmax-logmin)*nbins)] += 1;
-    }
+  void countBin(int kind, int bin, unsigned long long n) {
+    slots[kind * (nbins + 2) + bin + 1] += n;
+  }
+
+  // Bin shared by every distance in [min_dsq, max_dsq]; -2 if none of them
+  // falls in a bin, -1 if they span several
+  int findBin(Real min_dsq, Real max_dsq) const {
+    if (max_dsq < edges_sq.front() || min_dsq >= edges_sq.back()) return -2;
+    int a = slot(min_dsq), b = slot(max_dsq);
+    if (a != b) return -1;
+    return a - 1;
   }
 
-  int findBin(Real a, Real b) {
-    double loga = std::log(a);
-    double logb = std::log(b);
-    if (logb < logmin || loga >= logmax) {
-      return -2; // no need to split
-    } else {
-      int idx1 = int((loga-logmin)/(logmax-logmin)*nbins);
-      int idx2 = int((logb-logmin)/(logmax-logmin)*nbins);
-      if (idx1 < 0 || idx2 < 0 || idx1 != idx2) {
-          return -1; // continue to split
-      } else {
-          return idx1;
+  // Counts target against n sources. With ordered set, only sources with a
+  // smaller order are counted, so a leaf counted against itself sees each
+  // pair once.
+  void countLeaf(const Particle* sources, int n, const Particle& target, bool ordered) {
+    scratch.resize(n);
+    Real* __restrict__ dsq = scratch.data();
+    const Vector3D<Real> t = target.position;
+    for (int i = 0; i < n; i++) {
+      const Vector3D<Real> d = sources[i].position - t;
+      dsq[i] = d.x * d.x + d.y * d.y + d.z * d.z;
+    }
+    if (ordered) {
+      for (int i = 0; i < n; i++) {
+        if (sources[i].order >= target.order) dsq[i] = edges_sq.back();
       }
     }
+    const int t_kind = target.isRandom();
+    for (int i = 0; i < n; i++) {
+      count(t_kind + sources[i].isRandom(), dsq[i]);
+    }
   }
-
 };
 
 #endif
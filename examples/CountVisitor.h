@@ -1,73 +1,96 @@
 #ifndef PARATREET_COUNTVISITOR_H_
 #define PARATREET_COUNTVISITOR_H_
 
-#include <cmath>
+#include <algorithm>
 #include <vector>
-#include <queue>
 
 #include "paratreet.decl.h"
 #include "CountManager.h"
+#include "Utility.h"
 #include "common.h"
 
 extern CProxy_CountManager count_manager;
 
+// Two-point pair counts for CountManager. Each unordered pair of particles
+// is counted once: of two disjoint nodes only the one whose key comes
+// first counts the pair, and a leaf counted against itself compares
+// particle orders. Works from both startDown and startDual. Keys live on
+// Nodes and on packed LinearTree entries, so open takes either as its
+// source, while every traversal passes Nodes as targets.
 class CountVisitor {
 public:
   static constexpr const bool CallSelfLeaf = true;
 
 private:
-  static Real dist(Vector3D<Real> p1, Vector3D<Real> p2) {
-    return (p1-p2).length();
+  // Compares the keys as prefixes at the shallower depth; 0 means one node
+  // holds the other
+  static int compareKeys(Key a, Key b) {
+    int da = Utility::mssb64_pos(a), db = Utility::mssb64_pos(b);
+    if (da > db) a >>= da - db;
+    else b >>= db - da;
+    return (a > b) - (a < b);
   }
 
-  static Vector3D<Real> center(const CentroidData& data) {
-    return data.box.center();
+  static void distanceRange(const OrientedBox<Real>& a, const OrientedBox<Real>& b, Real& min_dsq, Real& max_dsq) {
+    min_dsq = max_dsq = 0;
+    for (int dim = 0; dim < 3; dim++) {
+      Real gap = std::max({Real(0), a.lesser_corner[dim] - b.greater_corner[dim], b.lesser_corner[dim] - a.greater_corner[dim]});
+      Real span = std::max(a.greater_corner[dim] - b.lesser_corner[dim], b.greater_corner[dim] - a.lesser_corner[dim]);
+      min_dsq += gap * gap;
+      max_dsq += span * span;
+    }
   }
 
-  static Real radius(const CentroidData& data) {
-    return data.box.size().length()/2;
+  // from is CentroidData, or its Opening for a packed LinearTree source
+  template <typename FromData>
+  static int findBin(const FromData& from, const CentroidData& on) {
+    Real min_dsq, max_dsq;
+    distanceRange(from.box, on.box, min_dsq, max_dsq);
+    return count_manager.ckLocalBranch()->findBin(min_dsq, max_dsq);
   }
 
-  static int findBin(const CentroidData& from, const CentroidData& on) {
-    Real d = dist(center(from), center(on));
-    Real r1 = radius(from), r2 = radius(on);
-    return count_manager.ckLocalBranch()->findBin(d - r1 - r2, d + r1 + r2);
+  template <typename FromData>
+  static void countBin(const FromData& from, const CentroidData& on, int bin) {
+    CountManager* countManager = count_manager.ckLocalBranch();
+    unsigned long long from_data = from.count - from.n_random, on_data = on.count - on.n_random;
+    countManager->countBin(CountManager::eDD, bin, from_data * on_data);
+    countManager->countBin(CountManager::eDR, bin, from_data * on.n_random + from.n_random * on_data);
+    countManager->countBin(CountManager::eRR, bin, (unsigned long long) from.n_random * on.n_random);
   }
 
 public:
-  static bool open(const SpatialNode<CentroidData>& from, SpatialNode<CentroidData>& on) {
+  template <typename Source>
+  static bool open(const Source& from, Node<CentroidData>& on) {
     if (from.data.count == 0 || on.data.count == 0) {
       return false;
     }
-    CountManager* countManager = count_manager.ckLocalBranch();
+    int order = compareKeys(from.key, on.key);
+    if (order > 0) return false; // counted with the roles swapped
     int idx = findBin(from.data, on.data);
-    if (idx < 0) {
-      return idx == -1;
-    } else {
-      countManager->bins[idx] += from.data.count * on.data.count;
-      return false;
-    }
+    if (idx == -2) return false;
+    if (order == 0 || idx == -1) return true;
+    countBin(from.data, on.data, idx);
+    return false;
   }
 
   static void node(const SpatialNode<CentroidData>& from, SpatialNode<CentroidData>& on) {}
 
-  static bool cell(const SpatialNode<CentroidData>& source, SpatialNode<CentroidData>& target) {
+  static bool cell(const Node<CentroidData>& source, Node<CentroidData>& target) {
     return open(source, target);
   }
 
-  static void leaf(const SpatialNode<CentroidData>& from, SpatialNode<CentroidData>& on) {
-    CountManager* countManager = count_manager.ckLocalBranch();
+  static void leaf(const Node<CentroidData>& from, Node<CentroidData>& on) {
+    int order = compareKeys(from.key, on.key);
+    if (order > 0) return;
     int idx = findBin(from.data, on.data);
-    if (idx < 0) {
-      for (int i = 0; i < from.n_particles; i++) {
-        for (int j = 0; j < on.n_particles; j++) {
-          const Vector3D<Real>& p1 = from.particles()[i].position;
-          const Vector3D<Real>& p2 = on.particles()[j].position;
-          countManager->count(dist(p1, p2));
-        }
-      }
-    } else {
-      countManager->bins[idx] += from.n_particles * on.n_particles;
+    if (idx == -2) return;
+    if (order < 0 && idx >= 0) {
+      countBin(from.data, on.data, idx);
+      return;
+    }
+    CountManager* countManager = count_manager.ckLocalBranch();
+    for (int j = 0; j < on.n_particles; j++) {
+      countManager->countLeaf(from.particles(), from.n_particles, on.particles()[j], order == 0);
     }
   }
 };
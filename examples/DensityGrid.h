@@ -0,0 +1,212 @@
+#ifndef PARATREET_DENSITYGRID_H_
+#define PARATREET_DENSITYGRID_H_
+
+#include "common.h"
+#include "Vector3D.h"
+#include "paratreet.decl.h"
+#include "FFT.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <vector>
+
+extern CProxy_ThreadStateHolder thread_state_holder;
+extern bool periodic;
+
+// Mass density on a periodic n^3 grid spanning a cube, split into
+// slabs of x planes across PEs, and its power spectrum. Particles are
+// deposited with cloud-in-cell or triangular-shaped-cloud weights into
+// per-PE planes that are then added into their owners' slabs. The
+// transform runs over y and z within each slab, transposes the slabs
+// into y ranges, and finishes along x, where each PE bins its modes.
+struct DensityGrid : public CBase_DensityGrid {
+  enum Scheme {eCIC = 2, eTSC = 3}; // Cells touched along each axis
+
+  int n = 0;
+  Scheme scheme = eCIC;
+
+  void reset(int n_, int scheme_, const CkCallback& cb) {
+    if (!FFT::isPowerOfTwo(n_)) CkAbort("Density grid size must be a power of two");
+    n = n_;
+    scheme = (Scheme) scheme_;
+    box = cube();
+    planes.clear();
+    x_begin = firstPlane(CkMyPe());
+    x_end = firstPlane(CkMyPe() + 1);
+    slab.assign((size_t)(x_end - x_begin) * n * n, 0);
+    n_blocks = 0;
+    this->contribute(cb);
+  }
+
+  // The cube the grid spans, used for both the deposit and the k spacing:
+  // the periodic box, which GravityVisitor replicates at unit offsets, or
+  // else the universe's longest side. Either is centered on the universe.
+  static OrientedBox<Real> cube() {
+    const auto& universe = thread_state_holder.ckLocalBranch()->universe.box;
+    const Vector3D<Real> size = universe.size();
+    const Real length = periodic ? 1 : std::max({size.x, size.y, size.z});
+    const Vector3D<Real> half (0.5 * length);
+    return OrientedBox<Real>(universe.center() - half, universe.center() + half);
+  }
+
+  // First of the planes owned by a PE, along x before the transpose and
+  // along y after it
+  int firstPlane(int pe) const {
+    return ((long long) pe * n + CkNumPes() - 1) / CkNumPes();
+  }
+
+  int owner(int plane) const {
+    return (long long) plane * CkNumPes() / n;
+  }
+
+  void deposit(const Particle* particles, int n_particles) {
+    const Real cells_per_length = n / box.size().x;
+    int cells[3][3];
+    Real weights[3][3];
+    for (int pi = 0; pi < n_particles; pi++) {
+      auto& p = particles[pi];
+      for (int dim = 0; dim < 3; dim++) {
+        stencil((p.position[dim] - box.lesser_corner[dim]) * cells_per_length, cells[dim], weights[dim]);
+      }
+      for (int i = 0; i < scheme; i++) {
+        auto& plane = planes[cells[0][i]];
+        if (plane.empty()) plane.resize((size_t) n * n, 0);
+        for (int j = 0; j < scheme; j++) {
+          Real wxy = p.mass * weights[0][i] * weights[1][j];
+          Real* row = &plane[(size_t) cells[1][j] * n];
+          for (int k = 0; k < scheme; k++) row[cells[2][k]] += wxy * weights[2][k];
+        }
+      }
+    }
+  }
+
+  // Sends the deposited planes to the PEs that own them
+  void flush() {
+    for (auto && plane : planes) {
+      thisProxy[owner(plane.first)].addPlane(plane.first, plane.second);
+    }
+    planes.clear();
+  }
+
+  void addPlane(int x, std::vector<Real> plane) {
+    FFT::Complex* dest = &slab[(size_t)(x - x_begin) * n * n];
+    for (size_t i = 0; i < plane.size(); i++) dest[i] += plane[i];
+  }
+
+  // Contributes, summed over PEs, the power |rho_k|^2 and the number of
+  // modes in each bin of |k| (in units of the fundamental mode) up to the
+  // Nyquist frequency, then the total mass
+  void transform(const CkCallback& cb) {
+    power_cb = cb;
+    total_mass = 0;
+    for (auto && cell : slab) total_mass += cell.real();
+
+    std::vector<FFT::Complex> scratch (n);
+    for (int x = x_begin; x < x_end; x++) {
+      FFT::Complex* plane = &slab[(size_t)(x - x_begin) * n * n];
+      for (int y = 0; y < n; y++) FFT::transform(&plane[(size_t) y * n], n);
+      for (int z = 0; z < n; z++) FFT::transformStrided(&plane[z], n, n, scratch.data());
+    }
+
+    // Every PE gets the y range it owns, with all z, of our x planes
+    for (int pe = 0; pe < CkNumPes(); pe++) {
+      int y_begin = firstPlane(pe), y_end = firstPlane(pe + 1);
+      std::vector<Real> block;
+      block.reserve(2 * (size_t)(x_end - x_begin) * (y_end - y_begin) * n);
+      for (int x = x_begin; x < x_end; x++) {
+        for (int y = y_begin; y < y_end; y++) {
+          const FFT::Complex* row = &slab[((size_t)(x - x_begin) * n + y) * n];
+          for (int z = 0; z < n; z++) {
+            block.push_back(row[z].real());
+            block.push_back(row[z].imag());
+          }
+        }
+      }
+      thisProxy[pe].receiveBlock(x_begin, x_end, block);
+    }
+  }
+
+  void receiveBlock(int block_x_begin, int block_x_end, std::vector<Real> block) {
+    // Pencils along x, one per (y, z) of our y range
+    const int y_begin = firstPlane(CkMyPe()), y_end = firstPlane(CkMyPe() + 1);
+    if (n_blocks == 0) pencils.assign((size_t)(y_end - y_begin) * n * n, 0);
+    size_t i = 0;
+    for (int x = block_x_begin; x < block_x_end; x++) {
+      for (int y = y_begin; y < y_end; y++) {
+        for (int z = 0; z < n; z++, i += 2) {
+          pencils[((size_t)(y - y_begin) * n + z) * n + x] = FFT::Complex(block[i], block[i + 1]);
+        }
+      }
+    }
+    if (++n_blocks == CkNumPes()) binPower(y_begin, y_end);
+  }
+
+private:
+  // Cells and weights along one axis for a position s in cell units
+  void stencil(Real s, int* cells, Real* weights) const {
+    if (scheme == eCIC) {
+      Real u = s - 0.5;
+      int i = std::floor(u);
+      Real f = u - i;
+      cells[0] = i;
+      cells[1] = i + 1;
+      weights[0] = 1 - f;
+      weights[1] = f;
+    }
+    else {
+      int i = std::floor(s);
+      Real d = s - (i + 0.5);
+      cells[0] = i - 1;
+      cells[1] = i;
+      cells[2] = i + 1;
+      weights[0] = 0.5 * (0.5 - d) * (0.5 - d);
+      weights[1] = 0.75 - d * d;
+      weights[2] = 0.5 * (0.5 + d) * (0.5 + d);
+    }
+    for (int c = 0; c < scheme; c++) cells[c] = (cells[c] % n + n) % n;
+  }
+
+  void binPower(int y_begin, int y_end) {
+    const int n_bins = n / 2;
+    std::vector<double> sums (2 * n_bins + 1, 0);
+    // Window of the assignment along one axis, divided out of each mode
+    std::vector<Real> window (n);
+    for (int i = 0; i < n; i++) {
+      int k = i <= n / 2 ? i : i - n;
+      Real arg = M_PI * k / n;
+      window[i] = k == 0 ? 1 : std::pow(std::sin(arg) / arg, (int) scheme);
+    }
+    for (int y = y_begin; y < y_end; y++) {
+      int ky = y <= n / 2 ? y : y - n;
+      for (int z = 0; z < n; z++) {
+        int kz = z <= n / 2 ? z : z - n;
+        FFT::Complex* pencil = &pencils[((size_t)(y - y_begin) * n + z) * n];
+        FFT::transform(pencil, n);
+        for (int x = 0; x < n; x++) {
+          int kx = x <= n / 2 ? x : x - n;
+          int bin = (int) std::lround(std::sqrt((double)(kx * kx + ky * ky + kz * kz)));
+          if (bin < 1 || bin > n_bins) continue;
+          Real w = window[x] * window[y] * window[z];
+          sums[bin - 1] += std::norm(pencil[x]) / (w * w);
+          sums[n_bins + bin - 1] += 1;
+        }
+      }
+    }
+    sums[2 * n_bins] = total_mass;
+    pencils.clear();
+    slab.clear();
+    this->contribute(sums.size() * sizeof(double), sums.data(), CkReduction::sum_double, power_cb);
+  }
+
+  OrientedBox<Real> box;
+  int x_begin = 0, x_end = 0;
+  std::map<int, std::vector<Real>> planes; // Deposits by x plane, not yet sent
+  std::vector<FFT::Complex> slab; // Our x planes, each n^2 with z fastest
+  std::vector<FFT::Complex> pencils;
+  int n_blocks = 0;
+  double total_mass = 0;
+  CkCallback power_cb;
+};
+
+#endif // PARATREET_DENSITYGRID_H_
@@ -5,6 +5,7 @@
 #include "common.h"
 #include "Space.h"
 #include "NeighborListCollector.h"
+#include "NeighborSearch.h"
 #include <cmath>
 #include <vector>
 #include <queue>
@@ -17,35 +18,30 @@ public:
 
 // in leaf check for not same particle plz
 private:
-  static constexpr const int k = 32;
+  static constexpr const int k = KnnStore::k;
 
 public:
-  static bool open(const SpatialNode<CentroidData>& source, SpatialNode<CentroidData>& target) {
+  template <typename Source>
+  static bool open(const Source& source, SpatialNode<CentroidData>& target) {
     // Check if any of the target balls intersect the source volume
-    for (int i = 0; i < target.n_particles; i++) {
-      if (target.data.pps.neighbors[i].size() < k) return true;
-      if(Space::intersect(source.data.box, target.particles()[i].position, target.data.pps.neighbors[i][0].fKey))
-        return true;
-    }
-    return false;
+    return NeighborSearch::intersects(source, target);
   }
 
   static void node(const SpatialNode<CentroidData>& source, SpatialNode<CentroidData>& target) {}
 
   static void leaf(const SpatialNode<CentroidData>& source, SpatialNode<CentroidData>& target) {
     auto nlc = neighbor_list_collector.ckLocalBranch();
+    if (!NeighborSearch::bucketIntersects(source, target)) return;
     for (int i = 0; i < target.n_particles; i++) {
-      auto& Q = target.data.pps.neighbors[i];
+      if (!NeighborSearch::particleIntersects(source, target, i)) continue;
+      auto Q = target.data.pps.neighbors(i);
       for (int j = 0; j < source.n_particles; j++) {
         const auto& sp = source.particles()[j]; //source particle
         Vector3D<Real> dr = target.particles()[i].position - sp.position;
         auto dsq = dr.lengthSquared();
         // Remove the most distant neighbor if this one is closer and the list is full
         if (Q.size() == k) {
-          if (dsq < Q[0].fKey) {
-            std::pop_heap(&(Q[0]) + 0, &(Q)[0] + k);
-            Q.resize(k-1);
-          }
+          if (dsq < Q[0].fKey) Q.popFarthest();
         }
         // Add the particle to the neighbor list if it isnt filled up
         if (Q.size() < k) {
@@ -55,11 +51,11 @@ public:
           pqNew.mass = sp.mass;
           pqNew.fKey = dsq;
           pqNew.pKey = sp.key;
-          Q.push_back(pqNew);
-          std::push_heap(&(Q)[0] + 0, &(Q)[0] + Q.size());
+          Q.push(pqNew);
         }
       }
     }
+    NeighborSearch::updateBall(target);
   }
 };
 
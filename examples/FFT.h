@@ -0,0 +1,50 @@
+#ifndef PARATREET_FFT_H_
+#define PARATREET_FFT_H_
+
+#include "common.h"
+#include <cmath>
+#include <complex>
+#include <utility>
+
+// In-place radix-2 complex FFTs, so the examples need no FFT library.
+// Forward transforms use e^{-ikx} and neither direction is normalized.
+namespace FFT {
+  using Complex = std::complex<Real>;
+
+  inline bool isPowerOfTwo(int n) {
+    return n > 0 && (n & (n - 1)) == 0;
+  }
+
+  inline void transform(Complex* data, int n, bool inverse = false) {
+    for (int i = 1, j = 0; i < n; i++) {
+      int bit = n >> 1;
+      for (; j & bit; bit >>= 1) j ^= bit;
+      j ^= bit;
+      if (i < j) std::swap(data[i], data[j]);
+    }
+    const Real sign = inverse ? 1 : -1;
+    for (int len = 2; len <= n; len <<= 1) {
+      const Real angle = sign * 2 * M_PI / len;
+      const Complex step (std::cos(angle), std::sin(angle));
+      for (int start = 0; start < n; start += len) {
+        Complex w (1, 0);
+        for (int k = 0; k < len / 2; k++) {
+          Complex even = data[start + k];
+          Complex odd = w * data[start + k + len / 2];
+          data[start + k] = even + odd;
+          data[start + k + len / 2] = even - odd;
+          w *= step;
+        }
+      }
+    }
+  }
+
+  // Transforms n values spaced stride apart, through a scratch buffer
+  inline void transformStrided(Complex* data, int n, int stride, Complex* scratch) {
+    for (int i = 0; i < n; i++) scratch[i] = data[i * stride];
+    transform(scratch, n);
+    for (int i = 0; i < n; i++) data[i * stride] = scratch[i];
+  }
+}
+
+#endif // PARATREET_FFT_H_
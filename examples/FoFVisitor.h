@@ -0,0 +1,50 @@
+#ifndef PARATREET_FOFVISITOR_H_
+#define PARATREET_FOFVISITOR_H_
+
+#include "paratreet.decl.h"
+#include "common.h"
+#include "GroupFinder.h"
+#include <algorithm>
+
+extern CProxy_GroupFinder group_finder;
+
+// Links every pair of particles within the linking length, see GroupFinder
+struct FoFVisitor {
+public:
+  static constexpr const bool CallSelfLeaf = true;
+
+private:
+  static Real boxDistanceSq(const OrientedBox<Real>& a, const OrientedBox<Real>& b) {
+    Real dsq = 0;
+    for (int dim = 0; dim < 3; dim++) {
+      Real gap = std::max({Real(0), a.lesser_corner[dim] - b.greater_corner[dim], b.lesser_corner[dim] - a.greater_corner[dim]});
+      dsq += gap * gap;
+    }
+    return dsq;
+  }
+
+public:
+  template <typename Source>
+  static bool open(const Source& source, SpatialNode<CentroidData>& target) {
+    return boxDistanceSq(source.data.box, target.data.box) <= group_finder.ckLocalBranch()->linking_sq;
+  }
+
+  static void node(const SpatialNode<CentroidData>& source, SpatialNode<CentroidData>& target) {}
+
+  static void leaf(const SpatialNode<CentroidData>& source, SpatialNode<CentroidData>& target) {
+    GroupFinder* finder = group_finder.ckLocalBranch();
+    if (boxDistanceSq(source.data.box, target.data.box) > finder->linking_sq) return;
+    for (int i = 0; i < target.n_particles; i++) {
+      auto& tp = target.particles()[i];
+      for (int j = 0; j < source.n_particles; j++) {
+        auto& sp = source.particles()[j];
+        if (sp.order == tp.order) continue;
+        if ((tp.position - sp.position).lengthSquared() <= finder->linking_sq) {
+          finder->link(tp.order, sp.order, tp.partition_idx != sp.partition_idx);
+        }
+      }
+    }
+  }
+};
+
+#endif // PARATREET_FOFVISITOR_H_
@@ -98,7 +98,8 @@ public:
     }
   }
 
-  static bool open(const SpatialNode<CentroidData>& source, SpatialNode<CentroidData>& target) {
+  template <typename Source>
+  static bool open(const Source& source, SpatialNode<CentroidData>& target) {
     if (source.n_particles <= nMinParticleNode) return true;
     return Space::intersect(target.data.box, source.data.centroid + offset(), source.data.rsq);
   }
@@ -0,0 +1,116 @@
+#ifndef PARATREET_GROUPFINDER_H_
+#define PARATREET_GROUPFINDER_H_
+
+#include "common.h"
+#include "Vector3D.h"
+#include "paratreet.decl.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Friends-of-friends groups. FoFVisitor links particles closer than the
+// linking length into a union-find on each PE, over particle orders, with
+// the smallest order of each set as its root. Links between particles of
+// different Partitions are then merged globally from the reduced boundary
+// links, and every Partition sums its particles into per-group records.
+struct GroupFinder : public CBase_GroupFinder {
+  // Partial sums of one group over the particles of one PE
+  struct Record {
+    int label = -1;
+    int n = 0;
+    Real mass = 0;
+    Vector3D<Real> moment = Vector3D<Real>(0, 0, 0);
+    Vector3D<Real> momentum = Vector3D<Real>(0, 0, 0);
+  };
+
+  Real linking_sq = 0;
+
+  void reset(Real linking_length, const CkCallback& cb) {
+    linking_sq = linking_length * linking_length;
+    parent.clear();
+    boundary.clear();
+    merged.clear();
+    groups.clear();
+    this->contribute(cb);
+  }
+
+  void link(int a, int b, bool crosses_partitions) {
+    parent.emplace(a, a);
+    parent.emplace(b, b);
+    if (crosses_partitions) {
+      boundary.insert(a);
+      boundary.insert(b);
+    }
+    int ra = find(a), rb = find(b);
+    if (ra < rb) parent[rb] = ra;
+    else if (rb < ra) parent[ra] = rb;
+  }
+
+  // Contributes a (local root, member) pair for every boundary particle
+  void collectLinks(const CkCallback& cb) {
+    std::vector<std::pair<int, int>> links;
+    for (int x : boundary) links.emplace_back(find(x), x);
+    this->contribute(links.size() * sizeof(links[0]), links.data(), CkReduction::concat, cb);
+  }
+
+  // Global labels of local roots whose sets reach other Partitions
+  void setLabels(std::vector<std::pair<int, int>> labels, const CkCallback& cb) {
+    merged.insert(labels.begin(), labels.end());
+    this->contribute(cb);
+  }
+
+  // Group of a particle, or -1 if it was never linked
+  int label(int order) {
+    if (parent.find(order) == parent.end()) return -1;
+    int root = find(order);
+    auto it = merged.find(root);
+    return it == merged.end() ? root : it->second;
+  }
+
+  void accumulate(const SpatialNode<CentroidData>& leaf) {
+    for (int i = 0; i < leaf.n_particles; i++) {
+      auto& p = leaf.particles()[i];
+      int l = label(p.order);
+      if (l < 0) continue;
+      auto& group = groups[l];
+      group.label = l;
+      group.n++;
+      group.mass += p.mass;
+      group.moment += p.mass * p.position;
+      group.momentum += p.mass * p.velocity;
+    }
+  }
+
+  void collectGroups(const CkCallback& cb) {
+    std::vector<Record> records;
+    for (auto && group : groups) records.push_back(group.second);
+    this->contribute(records.size() * sizeof(Record), records.data(), CkReduction::concat, cb);
+  }
+
+private:
+  int find(int x) {
+    int root = x;
+    for (auto it = parent.find(root); it != parent.end() && it->second != root; it = parent.find(root)) {
+      root = it->second;
+    }
+    while (x != root) {
+      int& up = parent[x];
+      x = up;
+      up = root;
+    }
+    return root;
+  }
+
+  std::unordered_map<int, int> parent;
+  std::unordered_set<int> boundary; // Particles linked to another Partition's
+  std::unordered_map<int, int> merged;
+  std::unordered_map<int, Record> groups;
+};
+
+#endif // PARATREET_GROUPFINDER_H_
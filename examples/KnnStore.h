@@ -0,0 +1,83 @@
+#ifndef PARATREET_KNNSTORE_H_
+#define PARATREET_KNNSTORE_H_
+
+#include "common.h"
+#include "ParticleComp.h"
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// Per-PE storage for the per-particle state of neighbor and collision
+// searches. Leaves claim a contiguous run the first time a search touches
+// them, and reset() recycles every run without freeing, so once the store
+// has grown to fit the PE's particles a step makes no allocations.
+class KnnStore {
+public:
+  static constexpr int k = 32; // Neighbors kept per particle
+
+  // Up to k neighbors of one particle, kept as a heap so that the
+  // farthest is always at index 0
+  class Neighbors {
+  public:
+    Neighbors(KnnStore* store_, size_t particle_) : store(store_), particle(particle_) {}
+
+    int size() const {return store->n_neighbors[particle];}
+    const pqSmoothNode& operator[](int i) const {return begin()[i];}
+
+    void push(const pqSmoothNode& node) {
+      int& n = store->n_neighbors[particle];
+      CkAssert(n < k);
+      begin()[n++] = node;
+      std::push_heap(begin(), begin() + n);
+    }
+    void popFarthest() {
+      int& n = store->n_neighbors[particle];
+      std::pop_heap(begin(), begin() + n);
+      n--;
+    }
+
+  private:
+    pqSmoothNode* begin() const {return &store->neighbors[particle * k];}
+
+    KnnStore* store;
+    size_t particle;
+  };
+
+  static KnnStore& local() {
+    static thread_local KnnStore store;
+    return store;
+  }
+
+  // Returns the index of the first of n_particles new neighbor lists
+  size_t claimNeighbors(int n_particles) {
+    size_t first = n_neighbors.size();
+    n_neighbors.resize(first + n_particles, 0);
+    neighbors.resize(n_neighbors.size() * k);
+    return first;
+  }
+
+  // Returns the index of the first of n_particles new closest collisions
+  size_t claimBestDt(int n_particles) {
+    size_t first = best_dt.size();
+    best_dt.resize(first + n_particles, std::make_pair(std::numeric_limits<Real>::max(), Particle{}));
+    return first;
+  }
+
+  Neighbors getNeighbors(size_t particle) {return Neighbors(this, particle);}
+  std::pair<Real, Particle>& getBestDt(size_t particle) {return best_dt[particle];}
+
+  // Claims made before this must not be used again
+  void reset() {
+    n_neighbors.clear();
+    neighbors.clear();
+    best_dt.clear();
+  }
+
+private:
+  std::vector<int> n_neighbors;
+  std::vector<pqSmoothNode> neighbors; // k slots per particle
+  std::vector<std::pair<Real, Particle>> best_dt;
+};
+
+#endif // PARATREET_KNNSTORE_H_
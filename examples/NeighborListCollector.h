@@ -4,6 +4,8 @@
 #include "common.h"
 #include "Vector3D.h"
 #include "paratreet.decl.h"
+#include "RemoteParticleStore.h"
+#include "SweepStore.h"
 
 #include <cstring>
 #include <cmath>
@@ -11,22 +13,20 @@
 struct NeighborListCollector : public CBase_NeighborListCollector {
   std::unordered_set<Key> already_requested;
   std::unordered_map<Key, std::vector<int>> requested_to; // value = pe
-  struct HomeState {
-    int subtree_home_pe = -1;
-    int partition_home_pe = -1;
-    HomeState(int s, int p) : subtree_home_pe(s), partition_home_pe(p) {}
-  };
-  using RemoteParticleMap = std::map<Key, std::pair<HomeState, Particle> >;
-  RemoteParticleMap remote_particles;
+  using HomeState = RemoteParticleStore::HomeState;
+  RemoteParticleStore remote_particles;
 
   // explanation: NLC is complicated because particles can be processed on one pe
   // but live in a Subtree on another pe
-  // remote_particles map helps you map particles to their partition_pe
+  // remote_particles store helps you map particles to their partition_pe
   // this way, you can send the flip-side forces to them for averaging.
   void reset(const CkCallback& cb) {
     already_requested.clear();
     requested_to.clear();
     remote_particles.clear();
+    // Recycle this PE's neighbor lists; last step's leaves are gone
+    KnnStore::local().reset();
+    SweepStore::local().reset();
     this->contribute(cb);
   }
   // only used in RTFORCE
@@ -37,10 +37,9 @@ struct NeighborListCollector : public CBase_NeighborListCollector {
     }
   }
   void fillRequest(int pe_home, Particle part) {
-    part.acceleration = Vector3D<Real>(0,0,0);
-    part.pressure_dVolume = 0;
     HomeState home_state {-1, -1};
-    remote_particles.emplace(part.key, std::make_pair(home_state, part));
+    bool inserted;
+    remote_particles.emplace(part, home_state, inserted);
   }
   void makeRequest(int pe, Key key) {
     if (already_requested.insert(key).second) {
@@ -58,47 +57,66 @@ struct NeighborListCollector : public CBase_NeighborListCollector {
     thisProxy[leaf.home_pe].savePartitionHome(thisIndex, part);
     // send density forward
   }
-  void saveSubtreeHome(int subtree_home_pe, Particle part) {
-    part.acceleration = Vector3D<Real>(0,0,0);
-    part.pressure_dVolume = 0;
+  void saveSubtreeHome(int subtree_home_pe, const Particle& part) {
     HomeState state {subtree_home_pe, -1};
-    remote_particles.emplace(part.key, std::make_pair(state, part));
+    bool inserted;
+    remote_particles.emplace(part, state, inserted);
   }
   void savePartitionHome(int partition_home_pe, Particle part) {
-    part.acceleration = Vector3D<Real>(0,0,0);
-    part.pressure_dVolume = 0;
     HomeState state {-1, partition_home_pe};
-    auto out = remote_particles.emplace(part.key, std::make_pair(state, part));
-    out.first->second.first.partition_home_pe = partition_home_pe;
+    bool inserted;
+    auto& entry = remote_particles.emplace(part, state, inserted);
+    entry.home.partition_home_pe = partition_home_pe;
   }
+  // Sends every accumulated contribution toward its particle's partition
+  // home in one message per destination PE. Contributions whose partition
+  // home is unknown here go to the particle's subtree home, which learned
+  // it from savePartitionHome, and are forwarded from there in bulk.
   void shareAccelerations() {
-    for (auto && remote_part : remote_particles) {
-      auto home_state = remote_part.second.first;
+    std::vector<std::vector<AccelerationUpdate>> to_add (CkNumPes()), to_forward (CkNumPes());
+    for (auto && remote_part : remote_particles.all()) {
+      auto home_state = remote_part.home;
+      AccelerationUpdate update {remote_part.key, remote_part.acceleration, remote_part.pressure_dVolume};
       if (home_state.partition_home_pe > -1) {
         if (home_state.partition_home_pe != thisIndex) { // dont want to double add
-          thisProxy[home_state.partition_home_pe].addAcceleration(remote_part.second.second);
+          to_add[home_state.partition_home_pe].push_back(update);
         }
       }
       else {
-        thisProxy[home_state.subtree_home_pe].forwardAcceleration(remote_part.second.second);
+        to_forward[home_state.subtree_home_pe].push_back(update);
       }
       // give it to someone else
       // then += all the remote contributions
       // then average
     }
+    forwardAccelerations(to_forward[thisIndex]);
+    for (int pe = 0; pe < CkNumPes(); pe++) {
+      if (!to_add[pe].empty()) thisProxy[pe].addAccelerations(to_add[pe]);
+      if (pe != thisIndex && !to_forward[pe].empty()) thisProxy[pe].forwardAccelerations(to_forward[pe]);
+    }
   }
-  void addAcceleration(Particle part) {
-    auto it = remote_particles.find(part.key);
-    CkAssert(it != remote_particles.end());
-    it->second.second.acceleration += part.acceleration;
-    it->second.second.pressure_dVolume += part.pressure_dVolume;
+  void addAccelerations(const std::vector<AccelerationUpdate>& updates) {
+    for (auto && update : updates) {
+      auto entry = remote_particles.find(update.key);
+      CkAssert(entry);
+      entry->acceleration += update.acceleration;
+      entry->pressure_dVolume += update.pressure_dVolume;
+    }
   }
-  void forwardAcceleration(Particle part) {
-    auto it = remote_particles.find(part.key);
-    CkAssert(it != remote_particles.end());
-    auto pHome = it->second.first.partition_home_pe;
-    CkAssert(pHome > -1);
-    thisProxy[pHome].addAcceleration(part);
+  void forwardAccelerations(const std::vector<AccelerationUpdate>& updates) {
+    if (updates.empty()) return;
+    std::vector<std::vector<AccelerationUpdate>> to_add (CkNumPes());
+    for (auto && update : updates) {
+      auto entry = remote_particles.find(update.key);
+      CkAssert(entry);
+      auto pHome = entry->home.partition_home_pe;
+      CkAssert(pHome > -1);
+      to_add[pHome].push_back(update);
+    }
+    addAccelerations(to_add[thisIndex]);
+    for (int pe = 0; pe < CkNumPes(); pe++) {
+      if (pe != thisIndex && !to_add[pe].empty()) thisProxy[pe].addAccelerations(to_add[pe]);
+    }
   }
 
 };
@@ -0,0 +1,64 @@
+#ifndef PARATREET_NEIGHBORSEARCH_H_
+#define PARATREET_NEIGHBORSEARCH_H_
+
+#include "common.h"
+#include "Space.h"
+#include "CentroidData.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Tests shared by the SPH neighbor visitors. Every search ball of a leaf
+// fits inside one ball around the leaf's box, so most source nodes are
+// rejected by a single test and only the survivors are checked particle by
+// particle. Sources are Nodes or packed LinearTree entries. The lists that
+// DensityVisitor finds stay in the leaf's KnnStore claim, where the
+// density, pressure and averaging passes read them again.
+namespace NeighborSearch {
+  constexpr Real unbounded = std::numeric_limits<Real>::max();
+
+  // Records the leaf's largest squared search radius, which stays unbounded
+  // until every particle has k neighbors
+  inline void updateBall(SpatialNode<CentroidData>& leaf) {
+    auto& pps = leaf.data.pps;
+    Real max_ball_sq = 0;
+    for (int i = 0; i < leaf.n_particles; i++) {
+      auto Q = pps.neighbors(i);
+      if (Q.size() < KnnStore::k) {
+        max_ball_sq = unbounded;
+        break;
+      }
+      max_ball_sq = std::max(max_ball_sq, Q[0].fKey);
+    }
+    pps.max_ball_sq = max_ball_sq;
+  }
+
+  template <typename Source>
+  inline bool bucketIntersects(const Source& source, const SpatialNode<CentroidData>& leaf) {
+    Real max_ball_sq = leaf.data.pps.max_ball_sq;
+    if (max_ball_sq == unbounded) return true;
+    auto& box = leaf.data.box;
+    Sphere<Real> ball (box.center(), 0.5 * box.size().length() + std::sqrt(max_ball_sq));
+    return Space::intersect(source.data.box, ball);
+  }
+
+  // Whether the search ball of particle i may reach the source node
+  template <typename Source>
+  inline bool particleIntersects(const Source& source, SpatialNode<CentroidData>& leaf, int i) {
+    auto Q = leaf.data.pps.neighbors(i);
+    if (Q.size() < KnnStore::k) return true;
+    return Space::intersect(source.data.box, leaf.particles()[i].position, Q[0].fKey);
+  }
+
+  // Whether any search ball of the leaf may reach the source node
+  template <typename Source>
+  inline bool intersects(const Source& source, SpatialNode<CentroidData>& leaf) {
+    if (!bucketIntersects(source, leaf)) return false;
+    for (int i = 0; i < leaf.n_particles; i++) {
+      if (particleIntersects(source, leaf, i)) return true;
+    }
+    return false;
+  }
+}
+
+#endif // PARATREET_NEIGHBORSEARCH_H_
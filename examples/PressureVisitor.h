@@ -4,6 +4,7 @@
 #include "common.h"
 #include "Space.h"
 #include "NeighborListCollector.h"
+#include "NeighborSearch.h"
 #include <cmath>
 
 extern CProxy_NeighborListCollector neighbor_list_collector;
@@ -24,23 +25,21 @@ public:
   }
 
 public:
-  static bool open(const SpatialNode<CentroidData>& source, SpatialNode<CentroidData>& target) {
+  template <typename Source>
+  static bool open(const Source& source, SpatialNode<CentroidData>& target) {
     // Check if any of the target balls intersect the source volume
     // Ball size is set by furthest neighbor found during density calculation
-    for (int i = 0; i < target.n_particles; i++) {
-      Real ballSq = target.data.pps.neighbors[i][0].fKey;
-      if(Space::intersect(source.data.box, target.particles()[i].position, ballSq))
-        return true;
-    }
-    return false;
+    return NeighborSearch::intersects(source, target);
   }
 
   static void node(const SpatialNode<CentroidData>& source, SpatialNode<CentroidData>& target) {}
 
   static void leaf(const SpatialNode<CentroidData>& source, SpatialNode<CentroidData>& target) {
     auto collector = neighbor_list_collector.ckLocalBranch();
+    if (!NeighborSearch::bucketIntersects(source, target)) return;
     for (int i = 0; i < target.n_particles; i++) {
-      Real rsq = target.data.pps.neighbors[i][0].fKey; // farthest distance, ball radius
+      if (!NeighborSearch::particleIntersects(source, target, i)) continue;
+      Real rsq = target.data.pps.neighbors(i)[0].fKey; // farthest distance, ball radius
       Real fBall = std::sqrt(rsq);
       for (int j = 0; j < source.n_particles; j++) {
         const Particle& a = target.particles()[i], b = source.particles()[j];
@@ -0,0 +1,100 @@
+#ifndef PARATREET_REMOTEPARTICLESTORE_H_
+#define PARATREET_REMOTEPARTICLESTORE_H_
+
+#include "common.h"
+#include "Particle.h"
+#include "Vector3D.h"
+#include "pup.h"
+#include <vector>
+
+// Contribution to a remote particle, exchanged in per-PE batches
+struct AccelerationUpdate {
+  Key key;
+  Vector3D<Real> acceleration;
+  Real pressure_dVolume;
+};
+PUPbytes(AccelerationUpdate);
+
+// Open-addressing hash table of the particles that SPH reads as neighbors
+// and accumulates forces into, keyed by particle key. Entries are stored
+// densely and keep only the fields the SPH kernels touch. clear() keeps all
+// memory, so lookups and inserts stop allocating after the first steps.
+// Like the NeighborListCollector that owns it, a store is only ever used
+// from its own PE.
+class RemoteParticleStore {
+public:
+  struct HomeState {
+    int subtree_home_pe = -1;
+    int partition_home_pe = -1;
+    HomeState(int s, int p) : subtree_home_pe(s), partition_home_pe(p) {}
+  };
+
+  struct Entry {
+    Entry(const Particle& p, HomeState state)
+      : key(p.key), home(state), mass(p.mass), position(p.position),
+        velocity_predicted(p.velocity_predicted),
+        acceleration(0, 0, 0), pressure_dVolume(0)
+    {
+    }
+
+    Key key;
+    HomeState home;
+    Real mass;
+    Vector3D<Real> position;
+    Vector3D<Real> velocity_predicted;
+    // Accumulated by the pressure pass
+    Vector3D<Real> acceleration;
+    Real pressure_dVolume;
+  };
+
+  // Returns the entry for p, inserting one with the given home state if
+  // p is new, in which case inserted is set
+  Entry& emplace(const Particle& p, HomeState state, bool& inserted) {
+    if (2 * (entries.size() + 1) > slots.size()) grow();
+    int& slot = findSlot(p.key);
+    inserted = slot < 0;
+    if (inserted) {
+      slot = entries.size();
+      entries.emplace_back(p, state);
+    }
+    return entries[slot];
+  }
+
+  Entry* find(Key key) {
+    if (slots.empty()) return nullptr;
+    int slot = findSlot(key);
+    return slot < 0 ? nullptr : &entries[slot];
+  }
+
+  std::vector<Entry>& all() {return entries;}
+
+  void clear() {
+    std::fill(slots.begin(), slots.end(), -1);
+    entries.clear();
+  }
+
+private:
+  size_t hash(Key key) const {
+    // Fibonacci hashing spreads the high-order SFC bits over the table
+    return (key * 0x9E3779B97F4A7C15ull) >> (KEY_BITS - log_n_slots);
+  }
+
+  int& findSlot(Key key) {
+    size_t mask = slots.size() - 1;
+    size_t i = hash(key);
+    while (slots[i] >= 0 && entries[slots[i]].key != key) i = (i + 1) & mask;
+    return slots[i];
+  }
+
+  void grow() {
+    log_n_slots = slots.empty() ? 10 : log_n_slots + 1;
+    slots.assign(size_t(1) << log_n_slots, -1);
+    for (int e = 0; e < entries.size(); e++) findSlot(entries[e].key) = e;
+  }
+
+  std::vector<int> slots; // Index into entries, or -1 if empty
+  std::vector<Entry> entries;
+  int log_n_slots = 0;
+};
+
+#endif // PARATREET_REMOTEPARTICLESTORE_H_
@@ -48,7 +48,9 @@ namespace paratreet {
     return adk;
   }
 
-  static void doSPHCalc(SpatialNode<CentroidData>& leaf, int pi, Real fBall, Particle& b) {
+  // b may be a Particle or a RemoteParticleStore::Entry
+  template <typename Neighbor>
+  static void doSPHCalc(SpatialNode<CentroidData>& leaf, int pi, Real fBall, Neighbor& b) {
     auto& a = leaf.particles()[pi];
     static constexpr const Real visc = 0.;
     static constexpr const Real fDivv_Corrector = 1.; // corrects bias wrt the divergence of velocities // RTFORCE
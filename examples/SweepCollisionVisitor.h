@@ -0,0 +1,91 @@
+#ifndef PARATREET_SWEEPCOLLISIONVISITOR_H_
+#define PARATREET_SWEEPCOLLISIONVISITOR_H_
+
+#include "common.h"
+#include "CollisionVisitor.h"
+#include "SweepStore.h"
+#include <cmath>
+#include <limits>
+
+// Same search as CollisionVisitor, but leaf pairs are swept along x: both
+// leaves are sorted once, each target only looks at sources whose x lies
+// within its ball, and collision times for that window are computed over
+// flat arrays so the loop vectorizes.
+struct SweepCollisionVisitor {
+public:
+  static constexpr const bool CallSelfLeaf = true;
+
+  template <typename Source>
+  static bool open(const Source& source, SpatialNode<CentroidData>& target) {
+    return CollisionVisitor::open(source, target);
+  }
+
+  static void node(const SpatialNode<CentroidData>& source, SpatialNode<CentroidData>& target) {}
+
+  static void leaf(const SpatialNode<CentroidData>& source, SpatialNode<CentroidData>& target) {
+    auto& s = SweepStore::local();
+    const auto t_run = s.get(target.particles(), target.n_particles);
+    const auto s_run = s.get(source.particles(), source.n_particles);
+    const size_t s_end = s_run.first + s_run.n;
+    size_t lo = s_run.first;
+    for (size_t ti = t_run.first; ti < t_run.first + t_run.n; ti++) {
+      // Targets ascend in x, so a source behind the widest ball around
+      // this target is behind every later one as well
+      while (lo < s_end && s.x[lo] < s.x[ti] - t_run.max_ball) lo++;
+      size_t hi = lo;
+      while (hi < s_end && s.x[hi] <= s.x[ti] + s.ball[ti]) hi++;
+      if (hi == lo) continue;
+
+      s.dt.resize(hi - lo);
+      collideTimes(s, ti, lo, hi);
+      int best = -1;
+      Real best_dt = std::numeric_limits<Real>::max();
+      for (size_t j = 0; j < hi - lo; j++) {
+        if (s.dt[j] < best_dt) {
+          best_dt = s.dt[j];
+          best = j;
+        }
+      }
+      if (best < 0) continue;
+      auto& closest = target.data.pps.best_dt(s.index[ti]);
+      if (best_dt < closest.first) {
+        closest = std::make_pair(best_dt, source.particles()[s.index[lo + best]]);
+      }
+    }
+  }
+
+private:
+  // CollisionVisitor::getCollideTime for target ti against sources
+  // [lo, hi), written without branches. Sources outside the target's ball,
+  // and the target itself, get the maximum time.
+  static void collideTimes(SweepStore& s, size_t ti, size_t lo, size_t hi) {
+    constexpr Real never = std::numeric_limits<Real>::max();
+    constexpr Real half_dt = 0.01570796326 / 2.;
+    const Real x = s.x[ti], y = s.y[ti], z = s.z[ti];
+    const Real vx = s.vx[ti] + half_dt * s.ax[ti];
+    const Real vy = s.vy[ti] + half_dt * s.ay[ti];
+    const Real vz = s.vz[ti] + half_dt * s.az[ti];
+    const Real soft = s.soft[ti], rsq = s.ball[ti] * s.ball[ti];
+    const int order = s.order[ti];
+    Real* __restrict__ dt = s.dt.data();
+    for (size_t j = lo; j < hi; j++) {
+      Real dx = x - s.x[j], dy = y - s.y[j], dz = z - s.z[j];
+      Real wx = vx - s.vx[j] - half_dt * s.ax[j];
+      Real wy = vy - s.vy[j] - half_dt * s.ay[j];
+      Real wz = vz - s.vz[j] - half_dt * s.az[j];
+      Real rdotv = dx * wx + dy * wy + dz * wz;
+      Real dx2 = dx * dx + dy * dy + dz * dz;
+      Real vRel2 = wx * wx + wy * wy + wz * wz;
+      Real sr = 2 * (soft + s.soft[j]);
+      Real inside = (dx2 - sr * sr) / (rdotv * rdotv) * vRel2;
+      Real D = std::sqrt(std::max(Real(0), 1 - inside));
+      Real dt1 = -rdotv / vRel2 * (1 + D);
+      Real dt2 = -rdotv / vRel2 * (1 - D);
+      Real t = (dt1 > 0 && dt1 < dt2) ? dt1 : ((dt2 > 0 && dt2 < dt1) ? dt2 : never);
+      bool hit = inside <= 1 && dx2 < rsq && s.order[j] != order;
+      dt[j - lo] = hit ? t : never;
+    }
+  }
+};
+
+#endif // PARATREET_SWEEPCOLLISIONVISITOR_H_
@@ -0,0 +1,77 @@
+#ifndef PARATREET_SWEEPSTORE_H_
+#define PARATREET_SWEEPSTORE_H_
+
+#include "common.h"
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+
+// Per-PE copies of leaf particles sorted along x, as flat arrays of the
+// fields a collision sweep reads. A leaf is sorted the first time a sweep
+// touches it and reused for every other leaf it meets; reset() drops the
+// copies but keeps the arrays' capacity.
+class SweepStore {
+public:
+  // Where a leaf's sorted particles start, and its largest ball
+  struct Run {
+    size_t first;
+    int n;
+    Real max_ball;
+  };
+
+  static SweepStore& local() {
+    static thread_local SweepStore store;
+    return store;
+  }
+
+  Run get(const Particle* particles, int n_particles) {
+    auto it = runs.find(particles);
+    if (it != runs.end()) return it->second;
+
+    sorted.resize(n_particles);
+    std::iota(sorted.begin(), sorted.end(), 0);
+    std::sort(sorted.begin(), sorted.end(), [&](int a, int b) {
+      return particles[a].position.x < particles[b].position.x;
+    });
+    Run run {x.size(), n_particles, 0};
+    for (int i : sorted) {
+      auto& p = particles[i];
+      x.push_back(p.position.x);
+      y.push_back(p.position.y);
+      z.push_back(p.position.z);
+      vx.push_back(p.velocity.x);
+      vy.push_back(p.velocity.y);
+      vz.push_back(p.velocity.z);
+      ax.push_back(p.acceleration.x);
+      ay.push_back(p.acceleration.y);
+      az.push_back(p.acceleration.z);
+      soft.push_back(p.soft);
+      ball.push_back(p.ball);
+      order.push_back(p.order);
+      index.push_back(i);
+      run.max_ball = std::max(run.max_ball, p.ball);
+    }
+    runs.emplace(particles, run);
+    return run;
+  }
+
+  // Claims made before this must not be used again
+  void reset() {
+    runs.clear();
+    for (auto v : {&x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az, &soft, &ball}) v->clear();
+    order.clear();
+    index.clear();
+  }
+
+  std::vector<Real> x, y, z, vx, vy, vz, ax, ay, az, soft, ball;
+  std::vector<int> order;
+  std::vector<int> index; // Position of the particle within its leaf
+  std::vector<Real> dt; // Scratch for one target's candidates
+
+private:
+  std::unordered_map<const Particle*, Run> runs;
+  std::vector<int> sorted;
+};
+
+#endif // PARATREET_SWEEPSTORE_H_
@@ -17,9 +17,11 @@ struct BoundingBox {
   int n_sph = 0;
   int n_dark = 0;
   int n_star = 0;
+  int max_order = -1; // New particles are given orders above every existing one
   Real pe;
   Real ke;
   Real mass;
+  Real work; // Sum of measured particle work, used for work-weighted decomposition
   static CkReduction::reducerType boxReducer;
 
   BoundingBox();
@@ -14,6 +14,9 @@
 
 extern CProxy_TreeSpec treespec;
 
+template <typename Data>
+struct CanopyReducer;
+
 template <typename Data>
 class CacheManager : public CBase_CacheManager<Data> {
 public:
@@ -30,6 +33,10 @@ public:
   CProxy_Resumer<Data> r_proxy;
   Data nodewide_data;
   std::atomic<size_t> num_buckets = ATOMIC_VAR_INIT(0ul);
+  // Set once the canopy reduction has been restored into this cache
+  bool canopy_loaded = false;
+  bool canopy_waiting = false;
+  CkCallback canopy_cb;
 
   CacheManager() { }
 
@@ -107,12 +114,17 @@ public:
     }
     this->contribute(cb);
   }
+  void destroy(bool restore, const CkCallback& cb) {
+    destroy(restore);
+    this->contribute(cb);
+  }
   void destroy(bool restore) {
     local_tps.clear();
     leaf_lookup.clear();
     subtree_copy_started.clear();
     prefetch_set.clear();
     cached_leaves.clear();
+    canopy_loaded = canopy_waiting = false;
 
     cleanupPlaceholders();
 
@@ -132,6 +144,8 @@ public:
   void requestNodes(std::pair<Key, int>);
   void serviceRequest(Node<Data>*, int);
   void recvStarterPack(std::pair<Key, SpatialNode<Data>>* pack, int n, CkCallback);
+  void recvCanopy(CkReductionMsg*);
+  void waitForCanopy(const CkCallback&);
   void addCache(MultiData<Data>);
   void receiveSubtree(MultiData<Data>, PPHolder<Data>);
   void restoreData(std::pair<Key, SpatialNode<Data>>);
@@ -224,11 +238,50 @@ void CacheManager<Data>::recvStarterPack(std::pair<Key, SpatialNode<Data>>* pack
     // if (!local_tps.count(pack[i].first))
     restoreDataHelper(pack[i], false);
   }
-  if (n == 0) root = local_tps[1];
+  if (n == 0) {
+    lockMaps();
+    root = local_tps[1];
+    unlockMaps();
+  }
   CkAssert(root);
   this->contribute(cb);
 }
 
+template <typename Data>
+void CacheManager<Data>::recvCanopy(CkReductionMsg* msg) {
+  // Every canopy node is restored, as TreeCanopies hold no data to serve
+  // requests for the rest in this mode
+  auto pack = CanopyReducer<Data>::unpack(msg->getData());
+  delete msg;
+
+  CkAssert(pack.empty() || pack[0].first == Key(1));
+  for (auto && record : pack) {
+    restoreDataHelper(record, false);
+  }
+  if (pack.empty()) {
+    lockMaps();
+    root = local_tps[1];
+    unlockMaps();
+  }
+  CkAssert(root);
+
+  lockMaps();
+  canopy_loaded = true;
+  bool waiting = canopy_waiting;
+  unlockMaps();
+  if (waiting) this->contribute(canopy_cb);
+}
+
+template <typename Data>
+void CacheManager<Data>::waitForCanopy(const CkCallback& cb) {
+  lockMaps();
+  canopy_cb = cb;
+  canopy_waiting = !canopy_loaded;
+  bool loaded = canopy_loaded;
+  unlockMaps();
+  if (loaded) this->contribute(cb);
+}
+
 template <typename Data>
 void CacheManager<Data>::receiveSubtree(MultiData<Data> multidata, PPHolder<Data> pp_holder) {
   addCacheHelper(multidata.particles.data(), multidata.particles.size(), multidata.nodes.data(), multidata.nodes.size(), multidata.cm_index, multidata.tp_index, true);
@@ -286,6 +339,11 @@ Node<Data>* CacheManager<Data>::addCacheHelper(Particle* particles, int n_partic
     }
     insertNode(node, false, true);
   }
+  // Nodes arrive in depth-first order and stay fixed until the cache is
+  // cleared, apart from placeholders that the walk looks up again
+  if (treespec.ckLocalBranch()->getConfiguration().linearize_tree) {
+    first_node->linear.reset(new LinearTree<Data>(first_node));
+  }
   if (add_to_tps) connect(first_node, leaves);
   else {
     auto && clv = cached_leaves[CkMyRank()];
@@ -374,14 +432,12 @@ void CacheManager<Data>::insertNode(Node<Data>* node, bool above_tp, bool should
     Key child_key = node->key * node->getBranchFactor() + i;
     bool add_placeholder = false;
     if (above_tp) {
+      lockMaps();
       auto it = local_tps.find(child_key);
-      if (it != local_tps.end()) {
-        new_child = it->second;
-        new_child->parent = node;
-      }
-      else {
-        add_placeholder = true;
-      }
+      if (it != local_tps.end()) new_child = it->second;
+      unlockMaps();
+      if (new_child) new_child->parent = node;
+      else add_placeholder = true;
     }
     if (!above_tp || add_placeholder) {
       auto type = (above_tp) ? Node<Data>::Type::RemoteAboveTPKey : Node<Data>::Type::Remote;
@@ -0,0 +1,77 @@
+#ifndef PARATREET_CHECKPOINT_H_
+#define PARATREET_CHECKPOINT_H_
+
+#include <string>
+
+#include "BoundingBox.h"
+#include "Configuration.h"
+#include "Decomposition.h"
+
+/*
+ * CheckpointHeader:
+ * Index file of a binary checkpoint. The particles themselves are written
+ * by each Reader to <prefix>.chk.<pe>, already grouped by Subtree, while
+ * this header (<prefix>.chk) holds what is needed to recreate the
+ * Partitions and Subtrees without searching for splitters again.
+ */
+struct CheckpointHeader {
+  static constexpr int kVersion = 1;
+
+  int version = kVersion;
+  int n_files = 0;
+  int iter = 0;
+  double time = 0;
+  int n_partitions = 0;
+  int n_subtrees = 0;
+  paratreet::DecompType decomp_type = paratreet::DecompType::eInvalid;
+  paratreet::TreeType tree_type = paratreet::TreeType::eInvalid;
+  BoundingBox universe;
+  // Owned only when unpacked by read()
+  Decomposition* partition_decomp = nullptr;
+  Decomposition* subtree_decomp = nullptr;
+
+  static std::string fileName(const std::string& prefix) {
+    return prefix + ".chk";
+  }
+
+  static std::string fileName(const std::string& prefix, int index) {
+    return prefix + ".chk." + std::to_string(index);
+  }
+
+  void pup(PUP::er& p) {
+    p | version;
+    if (version != kVersion) CkAbort("Checkpoint was written by an incompatible version");
+    p | n_files;
+    p | iter;
+    p | time;
+    p | n_partitions;
+    p | n_subtrees;
+    p | decomp_type;
+    p | tree_type;
+    p | universe;
+    p | partition_decomp;
+    p | subtree_decomp;
+  }
+
+  void write(const std::string& prefix) {
+    FILE* fp = CmiFopen(fileName(prefix).c_str(), "wb");
+    if (!fp) CkAbort("Could not open checkpoint header for writing");
+    PUP::toDisk p (fp);
+    pup(p);
+    int result = CmiFclose(fp);
+    CkAssert(result == 0);
+  }
+
+  void read(const std::string& prefix) {
+    FILE* fp = CmiFopen(fileName(prefix).c_str(), "rb");
+    if (!fp) {
+      CkPrintf("Could not open checkpoint header %s\n", fileName(prefix).c_str());
+      CkAbort("Checkpoint reading failure -- see stdout");
+    }
+    PUP::fromDisk p (fp);
+    pup(p);
+    CmiFclose(fp);
+  }
+};
+
+#endif // PARATREET_CHECKPOINT_H_
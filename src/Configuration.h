@@ -16,6 +16,9 @@ namespace paratreet {
       eSfc,
       eKd,
       eLongest,
+      eQuadOct,
+      eHexOct,
+      eTwoLevelOct,
       eInvalid = 100
     };
 
@@ -24,6 +27,9 @@ namespace paratreet {
       eBinaryOct,
       eKd,
       eLongest,
+      eQuadOct,
+      eHexOct,
+      eTwoLevelOct,
       eInvalid = 100
     };
 
@@ -39,8 +45,16 @@ namespace paratreet {
         int flush_period;
         int flush_max_avg_ratio;
         int lb_period;
+        bool load_per_node; // Read input on one PE per node and share it
+        int checkpoint_period; // Iterations between checkpoints, 0 to disable
+        int max_rung; // Each timestep is split into 2^max_rung substeps
+        bool fuse_canopy; // Reduce the canopy into caches instead of via TreeCanopy chares
+        bool linearize_tree; // Walk built and cached subtrees from depth-first arrays
+        bool halo_exchange; // Run short-range traversals on ghost particles instead of the cache
         std::string input_file;
         std::string output_file;
+        std::string checkpoint_file;
+        std::string restart_file; // Checkpoint to restart from instead of input_file
 #ifdef __CHARMC__
 #include "pup.h"
         void pup(PUP::er &p) {
@@ -55,8 +69,16 @@ namespace paratreet {
             p | flush_period;
             p | flush_max_avg_ratio;
             p | lb_period;
+            p | load_per_node;
+            p | checkpoint_period;
+            p | max_rung;
+            p | fuse_canopy;
+            p | linearize_tree;
+            p | halo_exchange;
             p | input_file;
             p | output_file;
+            p | checkpoint_file;
+            p | restart_file;
         }
 #endif //__CHARMC__
     };
@@ -71,6 +93,12 @@ namespace paratreet {
           return "KdTree";
         case TreeType::eLongest:
           return "LongestDimTree";
+        case TreeType::eQuadOct:
+          return "QuadOctTree";
+        case TreeType::eHexOct:
+          return "HexOctTree";
+        case TreeType::eTwoLevelOct:
+          return "TwoLevelOctTree";
         default:
           return "InvalidTreeType";
       }
@@ -88,6 +116,12 @@ namespace paratreet {
           return "KdDecomp";
 	case DecompType::eLongest:
           return "LongestDimDecomp";
+        case DecompType::eQuadOct:
+          return "QuadOctDecomp";
+        case DecompType::eHexOct:
+          return "HexOctDecomp";
+        case DecompType::eTwoLevelOct:
+          return "TwoLevelOctDecomp";
         default:
          return "InvalidDecompType";
       }
@@ -103,6 +137,12 @@ namespace paratreet {
           return DecompType::eKd;
         case TreeType::eLongest:
           return DecompType::eLongest;
+        case TreeType::eQuadOct:
+          return DecompType::eQuadOct;
+        case TreeType::eHexOct:
+          return DecompType::eHexOct;
+        case TreeType::eTwoLevelOct:
+          return DecompType::eTwoLevelOct;
         default:
           return DecompType::eInvalid;
       }
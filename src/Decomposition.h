@@ -55,10 +55,22 @@ struct Decomposition: public PUP::able {
 
   virtual void countAssignments(const std::vector<GenericSplitter>& states, const std::vector<Particle>& particles, Reader* reader, const CkCallback& cb, bool weight_by_partition) = 0;
 
+  // Same as countAssignments, but sums the measured Particle::work instead of counting
+  virtual void countWork(const std::vector<GenericSplitter>& states, const std::vector<Particle>& particles, Reader* reader, const CkCallback& cb);
+
+  // Drops Reader-side state derived from the particles by an earlier
+  // splitter search, since they may have moved or had their work change
+  virtual void resetSearch() {}
+
   virtual void doSplit(const std::vector<GenericSplitter>& splits, Reader* reader, const CkCallback& cb) {}
 
   virtual int findSplitters(BoundingBox &universe, CProxy_Reader &readers, int min_n_splitters) = 0;
 
+  // Rebalances the existing splitters for the particles now in the Readers,
+  // keeping the number of pieces and their tp keys unchanged. Returns false
+  // if this decomposition can only be recomputed from scratch.
+  virtual bool adjustSplitters(BoundingBox &universe, CProxy_Reader &readers) {return false;}
+
   virtual Key getTpKey(int idx) = 0;
 
   virtual void setArrayOpts(CkArrayOptions& opts, const std::vector<int>& partition_locations, bool collocate);
@@ -89,7 +101,10 @@ struct SfcDecomposition : public Decomposition {
   virtual int getNumParticles(int tp_index) override;
   virtual int getPartitionHome(int tp_index) override;
   virtual void countAssignments(const std::vector<GenericSplitter>& states, const std::vector<Particle>& particles, Reader* reader, const CkCallback& cb, bool weight_by_partition) override;
+  virtual void countWork(const std::vector<GenericSplitter>& states, const std::vector<Particle>& particles, Reader* reader, const CkCallback& cb) override;
+  virtual void resetSearch() override;
   virtual int findSplitters(BoundingBox &universe, CProxy_Reader &readers, int min_n_splitters) override;
+  virtual bool adjustSplitters(BoundingBox &universe, CProxy_Reader &readers) override;
   virtual void alignSplitters(SfcDecomposition *);
   std::vector<Splitter> getSplitters();
   virtual void pup(PUP::er& p) override;
@@ -97,11 +112,16 @@ struct SfcDecomposition : public Decomposition {
 private:
   int parallelFindSplitters(BoundingBox &universe, CProxy_Reader &readers, int min_n_splitters);
   int serialFindSplitters(BoundingBox &universe, CProxy_Reader &readers, int min_n_splitters);
+  std::vector<GenericSplitter> initSearchStates(BoundingBox &universe, int n_splitters);
+  int searchSplitters(BoundingBox &universe, CProxy_Reader &readers, std::vector<GenericSplitter>& states);
+  // Search state whose first count is of the keys in [from, to)
+  static GenericSplitter pieceState(Key from, Key to);
 
 protected:
   std::vector<Splitter> splitters;
   std::vector<int> partition_idxs;
   int saved_n_total_particles = 0;
+  std::vector<double> work_prefix; // Reader-side prefix sums of particle work
 };
 
 struct OctDecomposition : public SfcDecomposition {
@@ -115,6 +135,8 @@ struct OctDecomposition : public SfcDecomposition {
   virtual int flush(std::vector<Particle> &particles, const SendParticlesFn &fn) override;
   virtual void countAssignments(const std::vector<GenericSplitter>& states, const std::vector<Particle>& particles, Reader* reader, const CkCallback& cb, bool weight_by_partition) override;
   virtual int findSplitters(BoundingBox &universe, CProxy_Reader &readers, int min_n_splitters) override;
+  // Oct splitters are tree nodes, so their number changes with the particles
+  virtual bool adjustSplitters(BoundingBox &universe, CProxy_Reader &readers) override {return false;}
   virtual void setArrayOpts(CkArrayOptions& opts, const std::vector<int>& partition_locations, bool collocate) override;
 };
 
@@ -127,6 +149,33 @@ struct BinaryOctDecomposition : public OctDecomposition {
   virtual int getBranchFactor() const override {return 2;}
 };
 
+struct QuadOctDecomposition : public OctDecomposition {
+  PUPable_decl(QuadOctDecomposition);
+
+  QuadOctDecomposition(bool is_subtree) : OctDecomposition(is_subtree) {}
+  QuadOctDecomposition(CkMigrateMessage *m) : OctDecomposition(m) { }
+  virtual ~QuadOctDecomposition() = default;
+  virtual int getBranchFactor() const override {return 4;}
+};
+
+struct HexOctDecomposition : public OctDecomposition {
+  PUPable_decl(HexOctDecomposition);
+
+  HexOctDecomposition(bool is_subtree) : OctDecomposition(is_subtree) {}
+  HexOctDecomposition(CkMigrateMessage *m) : OctDecomposition(m) { }
+  virtual ~HexOctDecomposition() = default;
+  virtual int getBranchFactor() const override {return 16;}
+};
+
+struct TwoLevelOctDecomposition : public OctDecomposition {
+  PUPable_decl(TwoLevelOctDecomposition);
+
+  TwoLevelOctDecomposition(bool is_subtree) : OctDecomposition(is_subtree) {}
+  TwoLevelOctDecomposition(CkMigrateMessage *m) : OctDecomposition(m) { }
+  virtual ~TwoLevelOctDecomposition() = default;
+  virtual int getBranchFactor() const override {return 64;}
+};
+
 
 struct BinaryDecomposition : public Decomposition {
 
@@ -141,6 +190,8 @@ struct BinaryDecomposition : public Decomposition {
   int getNumParticles(int tp_index) override;
   int getPartitionHome(int tp_index) override;
   int findSplitters(BoundingBox &universe, CProxy_Reader &readers, int min_n_splitters) override;
+  bool adjustSplitters(BoundingBox &universe, CProxy_Reader &readers) override;
+  void resetSearch() override;
   void doSplit(const std::vector<GenericSplitter>& splits, Reader* reader, const CkCallback& cb) override;
 
   virtual void pup(PUP::er& p) override;
@@ -160,8 +211,10 @@ protected:
   size_t depth = 0;
   int saved_n_total_particles = 0;
   std::vector<int> bins_sizes;
+  std::vector<Real> bins_work; // Measured work per bin, empty when splitting by count
   std::vector<int> partition_idxs;
   std::vector<Bin> bins;
+  std::vector<std::vector<Real>> bins_particle_work; // Reader-side work of each Bin entry
 };
 
 struct KdDecomposition : public BinaryDecomposition {
@@ -171,6 +224,7 @@ struct KdDecomposition : public BinaryDecomposition {
 
   virtual BinarySplit sortAndGetSplitter(int depth, Bin& bin) override;
   virtual void countAssignments(const std::vector<GenericSplitter>& states, const std::vector<Particle>& particles, Reader* reader, const CkCallback& cb, bool weight_by_partition) override;
+  virtual void countWork(const std::vector<GenericSplitter>& states, const std::vector<Particle>& particles, Reader* reader, const CkCallback& cb) override;
   virtual void assign(Bin& parent, Bin& left, Bin& right, std::pair<int, Real> split) override;
   virtual std::vector<GenericSplitter> sortAndGetSplitters(BoundingBox &universe, CProxy_Reader &readers) override;
 };
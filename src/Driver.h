@@ -9,6 +9,7 @@
 #include <vector>
 
 #include <numeric>
+#include <set>
 #include "Reader.h"
 #include "Splitter.h"
 #include "TreeCanopy.h"
@@ -22,6 +23,7 @@
 #include "Modularization.h"
 #include "Node.h"
 #include "Writer.h"
+#include "Checkpoint.h"
 #include "Subtree.h"
 
 extern CProxy_Reader readers;
@@ -43,6 +45,14 @@ public:
   int n_partitions;
   double start_time;
   std::vector<int> partition_locations;
+  int start_iter = 0; // Nonzero when restarted from a checkpoint
+  int n_canopies = 0; // TreeCanopies reporting to recvTC each iteration
+  bool load_pending = false;
+  CkCallback load_cb;
+  // Set while particles flushed by rebuild are still in flight
+  bool flush_pending = false;
+  bool flush_waiting = false;
+  CkCallback flush_cb;
 
   Driver(CProxy_CacheManager<Data> cache_manager_, CProxy_Resumer<Data> resumer_, CProxy_TreeCanopy<Data> calculator_) :
     cache_manager(cache_manager_), resumer(resumer_), calculator(calculator_), storage_sorted(false) {}
@@ -57,7 +67,8 @@ public:
     cache_manager.initialize(CkCallbackResumeThread());
     // Useful particle keys
     CkPrintf("* Initialization\n");
-    decompose(0);
+    if (treespec.ckLocalBranch()->getConfiguration().restart_file.empty()) decompose(0);
+    else restore();
     cb.send();
   }
 
@@ -104,7 +115,7 @@ public:
       readers.assignKeys(universe, CkCallbackResumeThread());
       CkPrintf("Assigning keys and sorting particles: %.3lf ms\n",
         (CkWallTimer() - start_time) * 1000);
-    } else CkWaitQD();
+    }
 
     bool matching_decomps = config.decomp_type == paratreet::subtreeDecompForTree(config.tree_type);
     // Set up splitters for decomposition
@@ -116,15 +127,7 @@ public:
     CkPrintf("Setting up splitters for particle decompositions: %.3lf ms\n",
         (CkWallTimer() - start_time) * 1000);
 
-    // Create Partitions
-    CkArrayOptions partition_opts(n_partitions);
-    treespec.ckLocalBranch()->getPartitionDecomposition()->setArrayOpts(partition_opts, {}, false);
-    partitions = CProxy_Partition<Data>::ckNew(
-      n_partitions, cache_manager, resumer, calculator,
-      this->thisProxy, matching_decomps, partition_opts
-      );
-    CkPrintf("Created %d Partitions: %.3lf ms\n", n_partitions,
-        (CkWallTimer() - start_time) * 1000);
+    createPartitions(matching_decomps);
 
     start_time = CkWallTimer();
     readers.assignPartitions(n_partitions, partitions);
@@ -147,7 +150,30 @@ public:
           (CkWallTimer() - start_time) * 1000);
     }
 
-    // Create Subtrees
+    createSubtrees(matching_decomps);
+
+    start_time = CkWallTimer();
+    CkReductionMsg* sent;
+    readers.flush(n_subtrees, subtrees, CkCallbackResumeThread((void *&) sent));
+    waitForParticles(sent, subtrees);
+    CkPrintf("Flushing particles to Subtrees: %.3lf ms\n",
+        (CkWallTimer() - start_time) * 1000);
+    CkPrintf("**Total Decomposition time: %.3lf ms\n",
+        (CkWallTimer() - decomp_time) * 1000);
+  }
+
+  void createPartitions(bool matching_decomps) {
+    CkArrayOptions partition_opts(n_partitions);
+    treespec.ckLocalBranch()->getPartitionDecomposition()->setArrayOpts(partition_opts, {}, false);
+    partitions = CProxy_Partition<Data>::ckNew(
+      n_partitions, cache_manager, resumer, calculator,
+      this->thisProxy, matching_decomps, partition_opts
+      );
+    CkPrintf("Created %d Partitions: %.3lf ms\n", n_partitions,
+        (CkWallTimer() - start_time) * 1000);
+  }
+
+  void createSubtrees(bool matching_decomps) {
     start_time = CkWallTimer();
     CkArrayOptions subtree_opts(n_subtrees);
     if (matching_decomps) subtree_opts.bindTo(partitions);
@@ -160,83 +186,274 @@ public:
       );
     CkPrintf("Created %d Subtrees: %.3lf ms\n", n_subtrees,
         (CkWallTimer() - start_time) * 1000);
+    countCanopies();
+  }
+
+  // A TreeCanopy sits at every ancestor of a Subtree root
+  void countCanopies() {
+    auto decomp = treespec.ckLocalBranch()->getSubtreeDecomposition();
+    Key branch_factor = treespec.ckLocalBranch()->getTree()->getBranchFactor();
+    std::set<Key> canopy_keys;
+    for (int i = 0; i < n_subtrees; i++) {
+      Key key = decomp->getTpKey(i) / branch_factor;
+      while (key > 0 && canopy_keys.insert(key).second) key /= branch_factor;
+    }
+    n_canopies = canopy_keys.size();
+  }
+
+  // Tells each Partition how many Subtrees send it leaves, given the
+  // reduction of Subtrees' deliveries, and waits until all have arrived
+  void waitForLeaves(CkReductionMsg* msg) {
+    int* deliveries = (int*)msg->getData();
+    CkAssert(msg->getSize() == n_partitions * sizeof(int));
+    CkCallbackResumeThread cb;
+    for (int i = 0; i < n_partitions; i++) {
+      partitions[i].expectLeaves(deliveries[i], cb);
+    }
+    delete msg;
+  }
+
+  // Tells each Reader or Subtree how many particles were flushed to it,
+  // given the reduction of the senders' counts, and waits until all have
+  // arrived
+  template <typename Receivers>
+  void waitForParticles(CkReductionMsg* msg, Receivers receivers) {
+    CkCallbackResumeThread cb;
+    expectParticles(msg, receivers, cb);
+  }
+
+  // Same as waitForParticles, but returns while the particles are still
+  // in flight. waitForFlush blocks until they have all arrived.
+  template <typename Receivers>
+  void startFlush(CkReductionMsg* msg, Receivers receivers) {
+    flush_pending = true;
+    expectParticles(msg, receivers, CkCallback(CkReductionTarget(Driver<Data>, flushed), this->thisProxy));
+  }
+
+  void flushed() {
+    flush_pending = false;
+    if (flush_waiting) {
+      flush_waiting = false;
+      flush_cb.send();
+    }
+  }
 
+  void waitForFlush() {
+    if (!flush_pending) return;
+    CkCallbackResumeThread cb;
+    flush_cb = cb;
+    flush_waiting = true;
+  }
+
+  template <typename Receivers>
+  void expectParticles(CkReductionMsg* msg, Receivers receivers, const CkCallback& cb) {
+    int* sent = (int*)msg->getData();
+    int n_receivers = msg->getSize() / sizeof(int);
+    for (int i = 0; i < n_receivers; i++) {
+      receivers[i].expectParticles(sent[i], cb);
+    }
+    delete msg;
+  }
+
+  // Writes particles, already grouped by Subtree, and the decompositions
+  // needed to recreate this iteration's Partitions and Subtrees
+  void checkpoint(int iter) {
+    auto config = treespec.ckLocalBranch()->getConfiguration();
     start_time = CkWallTimer();
-    readers.flush(n_subtrees, subtrees);
+    partitions.checkpoint(CkCallbackResumeThread());
+    CkReductionMsg* result;
+    readers.writeCheckpoint(config.checkpoint_file, CkCallbackResumeThread((void*&)result));
+
+    CheckpointHeader header;
+    header.n_files = n_readers;
+    header.iter = iter;
+    header.time = *(double*)result->getData();
+    delete result;
+    header.n_partitions = n_partitions;
+    header.n_subtrees = n_subtrees;
+    header.decomp_type = config.decomp_type;
+    header.tree_type = config.tree_type;
+    header.universe = universe;
+    header.partition_decomp = treespec.ckLocalBranch()->getPartitionDecomposition();
+    header.subtree_decomp = treespec.ckLocalBranch()->getSubtreeDecomposition();
+    header.write(config.checkpoint_file);
+    CkPrintf("Writing checkpoint %s: %.3lf ms\n", CheckpointHeader::fileName(config.checkpoint_file).c_str(),
+        (CkWallTimer() - start_time) * 1000);
+  }
+
+  // Recreates Partitions and Subtrees from a checkpoint, skipping key
+  // assignment, the splitter search and the decomposition flush
+  void restore() {
+    auto config = treespec.ckLocalBranch()->getConfiguration();
+    double decomp_time = CkWallTimer();
+    start_time = CkWallTimer();
+    CheckpointHeader header;
+    header.read(config.restart_file);
+    if (header.decomp_type != config.decomp_type || header.tree_type != config.tree_type) {
+      CkAbort("Checkpoint was written with a different decomposition or tree type");
+    }
+    universe = header.universe;
+    thread_state_holder.setUniverse(universe);
+    start_iter = header.iter;
+    n_partitions = header.n_partitions;
+    n_subtrees = header.n_subtrees;
+    partition_locations.resize(n_partitions);
+    readers.restoreCheckpoint(config.restart_file, header.n_files, header.time, CkCallbackResumeThread());
+    treespec.receiveDecomposition(CkCallbackResumeThread(), CkPointer<Decomposition>(header.partition_decomp), false);
+    treespec.receiveDecomposition(CkCallbackResumeThread(), CkPointer<Decomposition>(header.subtree_decomp), true);
+    delete header.partition_decomp;
+    delete header.subtree_decomp;
+    CkPrintf("Reading checkpoint at iteration %d: %.3lf ms\n", start_iter,
+        (CkWallTimer() - start_time) * 1000);
+
+    bool matching_decomps = config.decomp_type == paratreet::subtreeDecompForTree(config.tree_type);
+    start_time = CkWallTimer();
+    createPartitions(matching_decomps);
+    createSubtrees(matching_decomps);
+
+    start_time = CkWallTimer();
+    CkReductionMsg* sent;
+    readers.flushCheckpoint(n_subtrees, subtrees, CkCallbackResumeThread((void *&) sent));
+    waitForParticles(sent, subtrees);
+    CkPrintf("Sending checkpointed particles to Subtrees: %.3lf ms\n",
+        (CkWallTimer() - start_time) * 1000);
+    CkPrintf("**Total Restart time: %.3lf ms\n",
+        (CkWallTimer() - decomp_time) * 1000);
+  }
+
+  // Rebalances the existing Partitions and Subtrees by adjusting the current
+  // splitters in place rather than recreating the chare arrays. Every
+  // particle still passes through the Reader on its own PE, but only those
+  // whose new Subtree lives on another PE cross the network. Returns false
+  // if either decomposition can only be rebuilt from scratch, in which case
+  // nothing has been broadcast yet.
+  bool redecompose() {
+    auto config = treespec.ckLocalBranch()->getConfiguration();
+    double decomp_time = CkWallTimer();
+
+    bool matching_decomps = config.decomp_type == paratreet::subtreeDecompForTree(config.tree_type);
+    start_time = CkWallTimer();
+    if (!matching_decomps && !treespec.ckLocalBranch()->getSubtreeDecomposition()->adjustSplitters(universe, readers)) return false;
+    if (!treespec.ckLocalBranch()->getPartitionDecomposition()->adjustSplitters(universe, readers)) return false;
+    treespec.receiveDecomposition(CkCallbackResumeThread(),
+        CkPointer<Decomposition>(treespec.ckLocalBranch()->getPartitionDecomposition()), false);
+    if (matching_decomps) {
+      treespec.receiveDecomposition(CkCallbackResumeThread(),
+        CkPointer<Decomposition>(treespec.ckLocalBranch()->getPartitionDecomposition()), true);
+    }
+    else {
+      treespec.receiveDecomposition(CkCallbackResumeThread(),
+        CkPointer<Decomposition>(treespec.ckLocalBranch()->getSubtreeDecomposition()), true);
+    }
+    CkPrintf("Adjusting splitters in place: %.3lf ms\n",
+        (CkWallTimer() - start_time) * 1000);
+
+    partitions.reset(CkCallbackResumeThread());
+    subtrees.reset(CkCallbackResumeThread());
+    start_time = CkWallTimer();
+    readers.assignPartitions(n_partitions, partitions);
     CkStartQD(CkCallbackResumeThread());
-    CkPrintf("Flushing particles to Subtrees: %.3lf ms\n",
+    CkReductionMsg* sent;
+    readers.flush(n_subtrees, subtrees, CkCallbackResumeThread((void *&) sent));
+    waitForParticles(sent, subtrees);
+    CkPrintf("Migrating particles to adjusted Partitions and Subtrees: %.3lf ms\n",
         (CkWallTimer() - start_time) * 1000);
-    CkPrintf("**Total Decomposition time: %.3lf ms\n",
+    CkPrintf("**Total Redecomposition time: %.3lf ms\n",
         (CkWallTimer() - decomp_time) * 1000);
+    return true;
   }
 
   // Core iterative loop of the simulation
   void run(CkCallback cb) {
     auto config = treespec.ckLocalBranch()->getConfiguration();
     double total_time = 0;
-    for (int iter = 0; iter < config.num_iterations; iter++) {
-      CkPrintf("\n* Iteration %d\n", iter);
+    const int n_substeps = 1 << config.max_rung;
+    Real timestep_size = 0, max_velocity = 0;
+    for (int iter = start_iter; iter < config.num_iterations; iter++) {
+      // Each iteration is one substep of a timestep; only particles on
+      // rungs at or above the active rung are kicked in it
+      const int substep = iter % n_substeps;
+      CkPrintf("\n* Iteration %d (active rung %d)\n", iter,
+          Utility::activeRung(substep, config.max_rung));
       double iter_start_time = CkWallTimer();
       // Start tree build in Subtrees
       start_time = CkWallTimer();
-      CkCallback timeCb (CkReductionTarget(Driver<Data>, reportTime), this->thisProxy);
-      subtrees.buildTree(partitions, timeCb);
-      CkWaitQD();
+      CkReductionMsg* deliveries;
+      subtrees.buildTree(partitions, CkCallbackResumeThread((void *&) deliveries));
+      CkPrintf("Tree build: %.3lf ms\n", (CkWallTimer() - start_time) * 1000);
+      waitForLeaves(deliveries);
       CkPrintf("Tree build and sending leaves: %.3lf ms\n", (CkWallTimer() - start_time) * 1000);
 
-      // Meta data collections, first for max velo
-      CkReductionMsg * msg, *msg2;
-      subtrees.collectMetaData(CkCallbackResumeThread((void *&) msg));
-      // Parse Subtree reduction message
-      int numRedn = 0, numRedn2 = 0;
-      CkReduction::tupleElement* res = nullptr, *res2 = nullptr;
-      msg->toTuple(&res, &numRedn);
-      Real max_velocity = *(Real*)(res[0].data); // avoid max_velocity = 0.0
-      Real timestep_size = paratreet::getTimestep(universe, max_velocity);
+      if (config.checkpoint_period > 0 && iter > start_iter && iter % config.checkpoint_period == 0) {
+        checkpoint(iter);
+      }
+
+      // Later iterations get the max velocity from the previous perturb
+      if (iter == start_iter) {
+        CkReductionMsg* msg;
+        subtrees.collectMetaData(CkCallbackResumeThread((void *&) msg));
+        int numRedn = 0;
+        CkReduction::tupleElement* res = nullptr;
+        msg->toTuple(&res, &numRedn);
+        max_velocity = *(Real*)(res[0].data); // avoid max_velocity = 0.0
+        delete[] res;
+        delete msg;
+      }
+      // The largest timestep is held fixed until every rung has synchronized
+      if (substep == 0 || iter == start_iter) {
+        timestep_size = paratreet::getTimestep(universe, max_velocity);
+      }
 
       ProxyPack<Data> proxy_pack (this->thisProxy, subtrees, partitions, cache_manager);
 
-      // Prefetch into cache
+      // Prefetch into cache; preTraversalFn and traversalFn return once
+      // their work is complete rather than relying on quiescence
       start_time = CkWallTimer();
       // use exactly one of these three commands to load the software cache
       paratreet::preTraversalFn(proxy_pack);
-      CkWaitQD();
       CkPrintf("TreeCanopy cache loading: %.3lf ms\n",
           (CkWallTimer() - start_time) * 1000);
 
       // Perform traversals
       start_time = CkWallTimer();
       paratreet::traversalFn(universe, proxy_pack, iter);
-      CkWaitQD();
       CkPrintf("Tree traversal: %.3lf ms\n", (CkWallTimer() - start_time) * 1000);
 
       start_time = CkWallTimer();
 
       // Move the particles in Partitions
-      partitions.kick(timestep_size, CkCallbackResumeThread());
+      partitions.kick(timestep_size, substep, CkCallbackResumeThread());
 
-      // Now track PE imbalance for memory reasons
-      thread_state_holder.collectMetaData(CkCallbackResumeThread((void *&) msg2));
-      msg2->toTuple(&res2, &numRedn2);
-      int maxPESize = *(int*)(res2[0].data);
-      int sumPESize = *(int*)(res2[1].data);
+      paratreet::postIterationFn(universe, proxy_pack, iter);
+
+      // A single reduction returns the new universe, the max velocity for
+      // the next timestep and the PE imbalance for memory reasons
+      CkReductionMsg* result;
+      partitions.perturb(timestep_size, substep, CkCallbackResumeThread((void *&)result));
+      int numRedn = 0;
+      CkReduction::tupleElement* res = nullptr;
+      result->toTuple(&res, &numRedn);
+      universe = *(BoundingBox*)(res[0].data);
+      max_velocity = *(Real*)(res[1].data);
+      int maxPESize = *(int*)(res[2].data);
+      int sumPESize = *(int*)(res[3].data);
+      delete[] res;
+      delete result;
       float avgPESize = (float) universe.n_particles / (float) CkNumPes();
       float ratio = (float) maxPESize / avgPESize;
       bool complete_rebuild = (config.flush_period == 0) ?
           (ratio > config.flush_max_avg_ratio) :
           (iter % config.flush_period == config.flush_period - 1) ;
       CkPrintf("[Meta] n_subtree = %d; timestep_size = %f; sumPESize = %d; maxPESize = %d, avgPESize = %f; ratio = %f; maxVelocity = %f; rebuild = %s\n", n_subtrees, timestep_size, sumPESize, maxPESize, avgPESize, ratio, max_velocity, (complete_rebuild? "yes" : "no"));
-      //End Subtree reduction message parsing
-
-      paratreet::postIterationFn(universe, proxy_pack, iter);
-
-      CkReductionMsg* result;
-      partitions.perturb(timestep_size, CkCallbackResumeThread((void *&)result));
-      universe = *((BoundingBox*)result->getData());
-      delete result;
       remakeUniverse();
-      partitions.rebuild(universe, subtrees, complete_rebuild); // 0.1s for example
-      CkWaitQD();
+      // Particles are flushed to the Subtrees, or to the Readers for a
+      // complete rebuild, while this iteration is torn down below. Subtree
+      // resets leave the incoming particles alone, so only redecomposition
+      // and the next tree build wait for the flush.
+      CkReductionMsg* sent;
+      partitions.rebuild(universe, subtrees, n_subtrees, complete_rebuild, CkCallbackResumeThread((void *&) sent));
+      if (complete_rebuild) startFlush(sent, readers);
+      else startFlush(sent, subtrees);
       CkPrintf("Perturbations: %.3lf ms\n", (CkWallTimer() - start_time) * 1000);
       if (!complete_rebuild && iter % config.lb_period == config.lb_period - 1){
         start_time = CkWallTimer();
@@ -245,29 +462,40 @@ public:
         CkWaitQD();
         CkPrintf("Load balancing: %.3lf ms\n", (CkWallTimer() - start_time) * 1000);
       }
-      // Destroy subtrees and perform decomposition from scratch
+      // Rebalance the existing subtrees, or destroy them and perform
+      // decomposition from scratch if the splitters cannot be adjusted
       if (complete_rebuild) {
-        treespec.reset();
-        subtrees.destroy();
-        partitions.destroy();
-        decompose(iter+1);
+        waitForFlush();
+        if (!redecompose()) {
+          treespec.reset();
+          subtrees.destroy();
+          partitions.destroy();
+          // Destroyed chares have nothing to contribute, so only quiescence
+          // shows that they are gone before the new arrays are created
+          CkWaitQD();
+          decompose(iter+1);
+        }
       } else {
-        partitions.reset();
-        subtrees.reset();
+        partitions.reset(CkCallbackResumeThread());
+        subtrees.reset(CkCallbackResumeThread());
       }
 
       // Clear cache and other storages used in this iteration
-      cache_manager.destroy(true);
-      CkCallback statsCb (CkReductionTarget(Driver<Data>, countInts), this->thisProxy);
-      thread_state_holder.collectAndResetStats(statsCb);
+      cache_manager.destroy(true, CkCallbackResumeThread());
+      CkReductionMsg* stats;
+      thread_state_holder.collectAndResetStats(CkCallbackResumeThread((void *&) stats));
+#if COUNT_INTERACTIONS
+      countInts((unsigned long long*)stats->getData());
+#endif
+      delete stats;
       storage.clear();
       storage_sorted = false;
-      CkWaitQD();
+      waitForFlush();
       double iter_time = CkWallTimer() - iter_start_time;
       total_time += iter_time;
       CkPrintf("Iteration %d time: %.3lf ms\n", iter, iter_time * 1000);
       if (iter == config.num_iterations-1) {
-        CkPrintf("Average iteration time: %.3lf ms\n", total_time / config.num_iterations * 1000);
+        CkPrintf("Average iteration time: %.3lf ms\n", total_time / (config.num_iterations - start_iter) * 1000);
       }
     }
 
@@ -277,19 +505,30 @@ public:
   // -------------------
   // Auxiliary functions
   // -------------------
-  void reportTime(){
-    CkPrintf("Tree build: %.3lf ms\n", (CkWallTimer() - start_time) * 1000);
-  }
-
   void countInts(unsigned long long* intrn_counts) {
      CkPrintf("%llu node-particle interactions, %llu bucket-particle interactions %llu node opens, %llu node closes\n", intrn_counts[0], intrn_counts[1], intrn_counts[2], intrn_counts[3]);
   }
 
   void recvTC(std::pair<Key, SpatialNode<Data>> param) {
     storage.emplace_back(param);
+    if (load_pending && (int) storage.size() == n_canopies) {
+      load_pending = false;
+      loadCache(load_cb);
+    }
   }
 
   void loadCache(CkCallback cb) {
+    // The canopy reduction seeds the caches itself, so only wait for it
+    if (treespec.ckLocalBranch()->getConfiguration().fuse_canopy) {
+      cache_manager.waitForCanopy(cb);
+      return;
+    }
+    // Wait for the rest of the TreeCanopies if the tree is still going up
+    if ((int) storage.size() < n_canopies) {
+      load_pending = true;
+      load_cb = cb;
+      return;
+    }
     auto config = treespec.ckLocalBranch()->getConfiguration();
     CkPrintf("Received data from %d TreeCanopies\n", (int) storage.size());
     // Sort data received from TreeCanopies (by their indices)
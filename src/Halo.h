@@ -0,0 +1,32 @@
+#ifndef PARATREET_HALO_H_
+#define PARATREET_HALO_H_
+
+#include "common.h"
+#include "OrientedBox.h"
+
+/*
+ * HaloBounds:
+ * What a Partition tells the others before a halo exchange. box bounds its
+ * particles, and search bounds the balls (Particle::ball) around them, so
+ * any particle that some search ball may reach lies inside search.
+ */
+struct HaloBounds {
+  int partition;
+  OrientedBox<Real> box;
+  OrientedBox<Real> search;
+
+  // Both boxes are empty when the Partition has no particles
+  static bool overlap(const OrientedBox<Real>& a, const OrientedBox<Real>& b) {
+    return a.lesser_corner.x <= b.greater_corner.x && b.lesser_corner.x <= a.greater_corner.x
+        && a.lesser_corner.y <= b.greater_corner.y && b.lesser_corner.y <= a.greater_corner.y
+        && a.lesser_corner.z <= b.greater_corner.z && b.lesser_corner.z <= a.greater_corner.z;
+  }
+
+  static bool contains(const OrientedBox<Real>& box, const Vector3D<Real>& v) {
+    return box.lesser_corner.x <= v.x && v.x <= box.greater_corner.x
+        && box.lesser_corner.y <= v.y && v.y <= box.greater_corner.y
+        && box.lesser_corner.z <= v.z && v.z <= box.greater_corner.z;
+  }
+};
+
+#endif // PARATREET_HALO_H_
@@ -48,4 +48,25 @@ public:
   virtual int getBranchFactor() override {return 2;}
 };
 
+// Wider octree variants. Each level consumes log2(branch factor) key bits,
+// so these only differ from OctTree in how many bits a level spans
+class QuadOctTree : public OctTree {
+public:
+  virtual ~QuadOctTree() = default;
+  virtual int getBranchFactor() override {return 4;}
+};
+
+class HexOctTree : public OctTree {
+public:
+  virtual ~HexOctTree() = default;
+  virtual int getBranchFactor() override {return 16;}
+};
+
+// Two octree levels collapsed into each node
+class TwoLevelOctTree : public OctTree {
+public:
+  virtual ~TwoLevelOctTree() = default;
+  virtual int getBranchFactor() override {return 64;}
+};
+
 #endif
@@ -2,8 +2,12 @@
 #define PARATREET_NODE_H_ 
 #include "common.h"
 #include "Particle.h"
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
 
 template <typename Data>
 class SpatialNode
@@ -11,14 +15,13 @@ class SpatialNode
 public:
   SpatialNode() = default;
   SpatialNode(const Data& _data, int _n_particles, bool _is_leaf, Particle* _particles, int _depth)
-    : data(_data), n_particles(_n_particles), is_leaf(_is_leaf), particles_(_particles), depth(_depth), home_pe(CkMyPe())
+    : n_particles(_n_particles), is_leaf(_is_leaf), particles_(_particles), data(_data), depth(_depth), home_pe(CkMyPe())
   {
   }
   SpatialNode(const SpatialNode<Data>& other, Particle* _particles)
-    : data(other.data), n_particles(other.n_particles), is_leaf(other.is_leaf), particles_(_particles), depth(other.depth), home_pe(other.home_pe)
+    : n_particles(other.n_particles), is_leaf(other.is_leaf), particles_(_particles), data(other.data), depth(other.depth), home_pe(other.home_pe)
   {
   }
-  virtual ~SpatialNode() = default;
 
   void changeParticle(int index, const Particle& part) {
     particles_[index] = part;
@@ -32,15 +35,35 @@ public:
   void applyPotential(int index, Real pot) {
     particles_[index].potential += pot;
   }
+  void setActive(int index, bool active) {
+    particles_[index].active = active;
+  }
+  void addWork(Real work) {
+    if (particles_ == nullptr) return;
+    for (int i = 0; i < n_particles; i++) {
+      particles_[i].work += work;
+    }
+  }
   void freeParticles() {
     if (n_particles > 0) {
       delete[] particles_;
     }
   }
-  void kick(Real timestep) {
+  // Kicks the active particles after giving each its rung for the coming
+  // step, which may only drop to rungs also due on this substep
+  void kick(Real max_timestep, int active_rung, int max_rung) {
+    for (int i = 0; i < n_particles; i++) {
+      auto& p = particles_[i];
+      if (!p.active) continue;
+      p.rung = std::max(p.desiredRung(max_timestep, max_rung), active_rung);
+      p.kick(p.rungTimestep(max_timestep));
+    }
+  }
+  bool hasActiveParticles() const {
     for (int i = 0; i < n_particles; i++) {
-      particles_[i].kick(timestep);
+      if (particles_[i].active) return true;
     }
+    return false;
   }
   void perturb(Real timestep) {
     for (int i = 0; i < n_particles; i++) {
@@ -59,26 +82,41 @@ public:
     }
   }
 
+  inline const Particle* particles() const {return particles_;}
+
+  // The particle count and leaf flag come first, next to the leading, hot
+  // part of data that opening tests read
 public:
-  Data      data;
   int       n_particles = 0;
   bool      is_leaf     = false;
+private:
+  Particle* particles_  = nullptr;
+public:
+  Data      data;
   int       depth       = 0;
   int       home_pe     = -1; // SUBTREE HOME
-  inline const Particle* particles() const {return particles_;}
-
-private:
-    Particle* particles_ = nullptr;
-
 };
 
+template <typename Data>
+struct LinearTree;
+
 template <typename Data>
 class Node : public SpatialNode<Data>
 {
 public:
-  virtual Node* getChild(int child_idx) const = 0;
-  virtual Node* exchangeChild(int child_idx, Node* child) = 0;
-  virtual size_t getBranchFactor() const = 0;
+  // Children live in the derived FullNode, but the base keeps a pointer to
+  // them so that traversals index the array directly without a virtual call
+  Node* getChild(int child_idx) const {
+    CkAssert(child_idx < n_children);
+    return children_[child_idx].load(std::memory_order_relaxed);
+  }
+  Node* exchangeChild(int child_idx, Node* child) {
+    CkAssert(child_idx < n_children);
+    return children_[child_idx].exchange(child, std::memory_order_relaxed);
+  }
+  size_t getBranchFactor() const {
+    return branch_factor_;
+  }
 
   enum class Type {
     Invalid = 0,
@@ -97,12 +135,15 @@ public:
 
   Node(const Data& data, int _n_particles, Particle* _particles, int _depth,
         int _n_children, Node* _parent, Type _type, Key _key,
-        int _owner_tp_start, int _owner_tp_end, int _tp_index, int _cm_index)
+        int _owner_tp_start, int _owner_tp_end, int _tp_index, int _cm_index,
+        std::atomic<Node*>* _children, size_t _branch_factor)
     : SpatialNode<Data>(data, _n_particles, _n_children == 0, _particles, _depth),
-      n_children(_n_children),
-      parent(_parent),
       type(_type),
+      n_children(_n_children),
+      children_(_children),
+      branch_factor_(static_cast<uint8_t>(_branch_factor)),
       key(_key),
+      parent(_parent),
       owner_tp_start(_owner_tp_start),
       owner_tp_end(_owner_tp_end),
       wait_count(_n_children),
@@ -111,12 +152,15 @@ public:
   {
   }
 
-  Node(Key _key, typename Node<Data>::Type _type, int _n_children, const SpatialNode<Data>& _spatial_node, Particle* _particles, Node<Data>* _parent)
+  Node(Key _key, typename Node<Data>::Type _type, int _n_children, const SpatialNode<Data>& _spatial_node, Particle* _particles, Node<Data>* _parent,
+        std::atomic<Node*>* _children, size_t _branch_factor)
     : SpatialNode<Data>(_spatial_node, _particles),
-      n_children(_n_children),
-      parent(_parent),
       type(_type),
-      key(_key)
+      n_children(_n_children),
+      children_(_children),
+      branch_factor_(static_cast<uint8_t>(_branch_factor)),
+      key(_key),
+      parent(_parent)
   {
   }
 
@@ -126,13 +170,19 @@ public:
     }
   }
 
+  // Read on every traversal step. These follow the whole SpatialNode,
+  // data included, so they do not share a cache line with its hot part
 public:
-  int n_children; // Subtree's recursiveBuild prevents the constness
-  Node* parent;   // CacheManager's insertNode  prevents the constness
   Type type;      // Subtree's recursiveBuild prevents the constness
+  int n_children; // Subtree's recursiveBuild prevents the constness
+private:
+  std::atomic<Node*>* const children_;
+  const uint8_t branch_factor_; // At most 64, see FullNode
+public:
   const Key key;
+  Node* parent;   // CacheManager's insertNode  prevents the constness
 
-  // this stuff gets edited:
+  // Cold bookkeeping for building, caching and freeing the tree
   int owner_tp_start = -1;
   int owner_tp_end   = -1;
   int wait_count     = -1;
@@ -140,6 +190,7 @@ public:
   int cm_index       = -1;
   std::atomic<bool> requested = ATOMIC_VAR_INIT(false);
   std::atomic<size_t> num_buckets_finished = ATOMIC_VAR_INIT(0);
+  std::unique_ptr<LinearTree<Data>> linear; // Set on roots of flattened subtrees
 
 public:
   Node<Data>* getDescendant(Key to_find) {
@@ -226,18 +277,19 @@ public:
 template <class Data, size_t BRANCH_FACTOR>
 class FullNode : public Node<Data>
 {
+  static_assert(BRANCH_FACTOR <= UINT8_MAX, "Node stores the branch factor in a byte");
+
 public:
-  FullNode() = default;
   virtual ~FullNode() = default;
 
   FullNode(Key _key, typename Node<Data>::Type _type, bool _is_leaf, const SpatialNode<Data>& _spatial_node, Particle* _particles, Node<Data>* _parent) // for cached non boundary nodes
-  : Node<Data>(_key, _type, _is_leaf ? 0 : BRANCH_FACTOR, _spatial_node, _particles, _parent)
+  : Node<Data>(_key, _type, _is_leaf ? 0 : BRANCH_FACTOR, _spatial_node, _particles, _parent, children.data(), BRANCH_FACTOR)
   {
     initChildren();
   }
 
   FullNode(Key _key, int _depth, int _n_particles, Particle* _particles, int _owner_tp_start, int _owner_tp_end, bool _is_leaf, Node<Data>* _parent, int _tp_index)
-    : Node<Data>(Data(), _n_particles, _particles, _depth, _is_leaf ? 0 : BRANCH_FACTOR, _parent, Node<Data>::Type::Invalid, _key, _owner_tp_start, _owner_tp_end, _tp_index, -1)
+    : Node<Data>(Data(), _n_particles, _particles, _depth, _is_leaf ? 0 : BRANCH_FACTOR, _parent, Node<Data>::Type::Invalid, _key, _owner_tp_start, _owner_tp_end, _tp_index, -1, children.data(), BRANCH_FACTOR)
   {
     initChildren();
   }
@@ -245,21 +297,44 @@ public:
   void initChildren() {
     for (auto && child : children) child.store(nullptr);
   }
- 
-  virtual Node<Data>* getChild(int child_idx) const override {
-    CkAssert(child_idx < this->n_children);
-    return children[child_idx].load(std::memory_order_relaxed);
-  }
-  virtual Node<Data>* exchangeChild(int child_idx, Node<Data>* child) override {
-    CkAssert(child_idx < this->n_children);
-    return children[child_idx].exchange(child, std::memory_order_relaxed);
-  }
-  virtual size_t getBranchFactor() const override {
-    return BRANCH_FACTOR;
-  }
 
 private:
   std::array<std::atomic<Node<Data>*>, BRANCH_FACTOR> children; 
 };
 
+// Depth-first array of the nodes of a subtree that no longer changes. Each
+// entry packs what opening tests read of the node, Data::Opening, and
+// records where its own subtree ends, so a walk can test and step past
+// nodes without touching the scattered Nodes. The Node is followed only
+// for leaves, node interactions and placeholders. Visitors therefore take
+// the source of open() as a template, a Node or an Entry.
+template <typename Data>
+struct LinearTree
+{
+  struct Entry {
+    typename Data::Opening data;
+    int n_particles;
+    bool is_leaf;
+    typename Node<Data>::Type type;
+    int skip; // Index of the first entry after this node's subtree
+    Key key;
+    Node<Data>* node;
+  };
+  std::vector<Entry> entries;
+
+  explicit LinearTree(Node<Data>* root) {
+    add(root);
+  }
+
+private:
+  void add(Node<Data>* node) {
+    int index = entries.size();
+    entries.push_back({node->data.opening(), node->n_particles, node->is_leaf, node->type, 0, node->key, node});
+    for (int i = 0; i < node->n_children; i++) {
+      add(node->getChild(i));
+    }
+    entries[index].skip = entries.size();
+  }
+};
+
 #endif // PARATREET_NODE_H_
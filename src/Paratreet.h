@@ -9,6 +9,7 @@
 #include "CoreFunctions.h"
 
 #include "BoundingBox.h"
+#include "Halo.h"
 #include "ParticleMsg.h"
 #include "Reader.h"
 #include "ThreadStateHolder.h"
@@ -80,10 +81,12 @@ namespace paratreet {
             CkIndex_Subtree<T>::__register(__makeName("Subtree"), sizeof(Subtree<T>));
             CkIndex_TreeCanopy<T>::__register(__makeName("TreeCanopy"), sizeof(TreeCanopy<T>));
             CkIndex_Driver<T>::__register(__makeName("Driver"), sizeof(Driver<T>));
+            CanopyReducer<T>::registerReducer();
 
             CkIndex_Reader::idx_request<T>( static_cast<void (Reader::*)(const CProxy_Subtree<T> &, int, int)>(NULL));
-            CkIndex_Reader::idx_flush<T>( static_cast<void (Reader::*)(int, const CProxy_Subtree<T> &)>(NULL));
+            CkIndex_Reader::idx_flush<T>( static_cast<void (Reader::*)(int, const CProxy_Subtree<T> &, const CkCallback &)>(NULL));
             CkIndex_Reader::idx_assignPartitions<T>( static_cast<void (Reader::*)(int, const CProxy_Partition<T> &)>(NULL));
+            CkIndex_Reader::idx_flushCheckpoint<T>( static_cast<void (Reader::*)(int, const CProxy_Subtree<T> &, const CkCallback &)>(NULL));
         }
     };
 
@@ -150,24 +153,66 @@ namespace paratreet {
 
     void updateConfiguration(const Configuration&, CkCallback);
 
+    // Gives every Partition copies of the other Partitions' particles that
+    // fall within its particles' balls, for startHalo to use as sources
     template<typename Data>
-    void outputParticleAccelerations(BoundingBox& universe, CProxy_Partition<Data>& partitions) {
+    void exchangeHalo(CProxy_Partition<Data>& partitions) {
+        CkReductionMsg* msg;
+        partitions.haloBounds(CkCallbackResumeThread((void*&)msg));
+        std::vector<HaloBounds> all_bounds;
+        auto elem = (CkReduction::setElement*)msg->getData();
+        while (elem != nullptr) {
+            all_bounds.push_back(*(HaloBounds*)&elem->data);
+            elem = elem->next();
+        }
+        delete msg;
+        std::vector<OrientedBox<Real>> boxes (all_bounds.size()), searches (all_bounds.size());
+        for (auto && bounds : all_bounds) {
+            boxes[bounds.partition] = bounds.box;
+            searches[bounds.partition] = bounds.search;
+        }
+        partitions.sendHalo(boxes, searches, CkCallbackResumeThread());
+    }
+
+    template<typename Data>
+    void outputParticleAccelerations(BoundingBox& universe, CProxy_Partition<Data>& partitions, bool binary = false) {
         auto& output_file = treespec.ckLocalBranch()->getConfiguration().output_file;
         CProxy_Writer w = CProxy_Writer::ckNew(output_file, universe.n_particles);
         CkPrintf("Outputting particle accelerations for verification...\n");
-        partitions.output(w, universe.n_particles, CkCallback::ignore);
+        partitions.output(w, universe.max_order + 1, CkCallback::ignore);
         CkWaitQD();
-        w[0].write(CkCallbackResumeThread());
+        w.write(binary, CkCallbackResumeThread());
     }
 
+    // Copies particles into the writers' staging buffers and returns while
+    // the snapshot is written in the background. The returned writers must be
+    // passed to finishSnapshot before the file is read or the program exits.
     template<typename Data>
-    void outputTipsy(BoundingBox& universe, CProxy_Partition<Data>& partitions) {
+    CProxy_TipsyWriter startTipsySnapshot(BoundingBox& universe, CProxy_Partition<Data>& partitions) {
         auto& output_file = treespec.ckLocalBranch()->getConfiguration().output_file;
         CProxy_TipsyWriter tw = CProxy_TipsyWriter::ckNew(output_file, universe);
-        CkPrintf("Outputting to Tipsy file...\n");
-        partitions.output(tw, universe.n_particles, CkCallback::ignore);
-        CkWaitQD();
-        tw[0].write(0, CkCallbackResumeThread());
+        CkPrintf("Starting Tipsy snapshot...\n");
+        CkReductionMsg* msg;
+        partitions.output(tw, universe.max_order + 1, CkCallbackResumeThread((void*&)msg));
+        int numRedn = 0;
+        CkReduction::tupleElement* res = nullptr;
+        msg->toTuple(&res, &numRedn);
+        int* counts = (int*)(res[0].data);
+        Real time = *(double*)(res[1].data);
+        int iter = *(int*)(res[2].data);
+        tw.write(std::vector<int>(counts, counts + CkNumPes()), time, iter);
+        delete[] res;
+        delete msg;
+        return tw;
+    }
+
+    inline void finishSnapshot(CProxy_TipsyWriter tw) {
+        tw.finish(CkCallbackResumeThread());
+    }
+
+    template<typename Data>
+    void outputTipsy(BoundingBox& universe, CProxy_Partition<Data>& partitions) {
+        finishSnapshot(startTipsySnapshot(universe, partitions));
     }
 }
 
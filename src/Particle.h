@@ -22,11 +22,16 @@ struct Particle {
   Vector3D<Real> velocity_predicted;
   Real pressure_dVolume = 0.;
   Real u_predicted;
+  Real work = 0.; // Interactions computed for this particle since the last tree build
+  int rung = 0; // Block timestep level, stepping by max_timestep / 2^rung
+  bool active = true; // Whether this substep computes forces for the particle
+  bool deleted = false; // Dropped when the Partition next copies out its particles
 
   enum class Type : char {
     eStar = 1,
     eGas  = 2,
     eDark = 3,
+    eRandom = 4, // Point of a random catalog, for correlation functions
     eUnknown = 100
   };
   Type type = Type::eUnknown;
@@ -36,6 +41,7 @@ struct Particle {
   bool isStar() const {return type == Type::eStar;}
   bool isGas()  const {return type == Type::eGas;}
   bool isDark() const {return type == Type::eDark;}
+  bool isRandom() const {return type == Type::eRandom;}
 
   void pup(PUP::er&) ;
 
@@ -44,6 +50,11 @@ struct Particle {
 
   void kick(Real timestep);
   void perturb(Real timestep);
+  void perturb(Real timestep, Real drift_timestep);
+  void drift(Real timestep);
+  void resetAccumulated();
+  int desiredRung(Real max_timestep, int max_rung) const;
+  Real rungTimestep(Real max_timestep) const {return max_timestep / (1 << rung);}
   void adjustNewUniverse(OrientedBox<Real> universe);
 
   bool operator==(const Particle&) const;
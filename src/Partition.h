@@ -1,17 +1,23 @@
 #ifndef _PARTITION_H_
 #define _PARTITION_H_
 
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <unordered_set>
 #include <vector>
 
 #include "CoreFunctions.h"
 
 #include "Particle.h"
+#include "Halo.h"
 #include "Traverser.h"
 #include "ParticleMsg.h"
 #include "MultiData.h"
 #include "ThreadStateHolder.h"
 #include "paratreet.decl.h"
 
+extern int n_readers;
 extern CProxy_TreeSpec treespec;
 extern CProxy_Reader readers;
 extern CProxy_ThreadStateHolder thread_state_holder;
@@ -21,6 +27,7 @@ struct Partition : public CBase_Partition<Data> {
   std::mutex receive_lock;
   std::vector<Node<Data>*> leaves;
   std::vector<Node<Data>*> tree_leaves;
+  std::vector<bool> active_leaves; // Leaves with particles that need forces
   std::vector<Particle> saved_particles;
   bool matching_decomps;
 
@@ -32,6 +39,9 @@ struct Partition : public CBase_Partition<Data> {
   // filled in during traversal
   std::vector<std::vector<Node<Data>*>> interactions;
 
+  // Copies of other Partitions' particles from the last halo exchange
+  std::vector<Node<Data>*> ghost_leaves;
+
   CProxy_TreeCanopy<Data> tc_proxy;
   CProxy_CacheManager<Data> cm_proxy;
   CacheManager<Data> *cm_local;
@@ -41,22 +51,46 @@ struct Partition : public CBase_Partition<Data> {
   Partition(int, CProxy_CacheManager<Data>, CProxy_Resumer<Data>, TCHolder<Data>, CProxy_Driver<Data> driver, bool);
   Partition(CkMigrateMessage * msg){delete msg;};
 
-  template<typename Visitor> void startDown();
-  template<typename Visitor> void startUpAndDown();
+  template<typename Visitor> void startDown(CkCallback);
+  template<typename Visitor> void startUpAndDown(CkCallback);
+  template<typename Visitor> void startHalo(CkCallback);
   void goDown();
   void interact(const CkCallback& cb);
 
+  void haloBounds(const CkCallback&);
+  void sendHalo(std::vector<OrientedBox<Real>>, std::vector<OrientedBox<Real>>, CkCallback);
+  void receiveHalo(std::vector<Particle>);
+
   void addLeaves(const std::vector<Node<Data>*>&, int);
   void receiveLeaves(std::vector<Key>, Key, int, TPHolder<Data>);
+  void expectLeaves(int, CkCallback);
+  void leavesReceived();
   void destroy();
   void reset();
-  void kick(Real, CkCallback);
-  void perturb(Real, CkCallback);
-  void rebuild(BoundingBox, TPHolder<Data>, bool);
-  void output(CProxy_Writer w, int n_total_particles, CkCallback cb);
-  void output(CProxy_TipsyWriter w, int n_total_particles, CkCallback cb);
+  void reset(const CkCallback& cb);
+  void kick(Real, int, CkCallback);
+  void perturb(Real, int, CkCallback);
+  // Sends our particles to the Subtrees, or to the Readers if if_flush,
+  // and contributes to cb how many went to each of them
+  void rebuild(BoundingBox, TPHolder<Data>, int n_subtrees, bool if_flush, const CkCallback& cb);
+  // Particles are spread over the writers by order, in [0, n_orders)
+  void output(CProxy_Writer w, int n_orders, CkCallback cb);
+  void output(CProxy_TipsyWriter w, int n_orders, CkCallback cb);
   void callPerLeafFn(int indicator, const CkCallback& cb);
-  void deleteParticleOfOrder(int order) {particle_delete_order.insert(order);}
+  void checkpoint(const CkCallback& cb);
+  // Particle lifecycle, applied when particles are next copied out of the
+  // leaves. Our own particles are named by leaf and index. Deletions of
+  // other Partitions' particles are batched per Partition and sent at the
+  // end of callPerLeafFn, whose callback is only called once every
+  // Partition has applied every batch sent to it. Spawned particles are
+  // given unused orders.
+  void deleteParticle(SpatialNode<Data>& leaf, int index);
+  void deleteRemoteParticle(const Particle& p); // p is a copy
+  void mergeParticle(SpatialNode<Data>& leaf, int index, const Particle& other);
+  void spawnParticle(Particle p);
+  void deleteParticles(std::vector<int> orders);
+  void expectDeletions(CkReductionMsg* msg);
+  void findActiveLeaves();
   void pup(PUP::er& p);
   void makeLeaves(int);
   void pauseForLB(){
@@ -70,15 +104,39 @@ struct Partition : public CBase_Partition<Data> {
   int iter = 1;
 
 private:
-  std::set<int> particle_delete_order;
+  // Orders of particles to delete, by owning Partition
+  std::map<int, std::vector<int>> remote_deletions;
+  // Deletion batches from other Partitions in the current callPerLeafFn
+  int n_deletion_batches = 0;
+  int expected_deletion_batches = -1;
+  CkCallback deletions_cb;
+  std::vector<Particle> spawned_particles;
+  // Leaf deliveries from Subtrees, one per Subtree holding our particles
+  int n_leaf_deliveries = 0;
+  int expected_leaf_deliveries = -1;
+  CkCallback leaves_cb;
+  // Contributed to once the current traversal needs no more remote nodes
+  CkCallback traversal_cb;
+  bool traversal_pending = false;
+  // Halo messages from other Partitions, one per Partition that may hold
+  // particles in our search balls
+  int n_halo_received = 0;
+  int expected_halo = -1;
+  CkCallback halo_cb;
 
 private:
   void initLocalBranches();
   void erasePartition();
   void copyParticles(std::vector<Particle>& particles, bool check_delete);
-  void flush(CProxy_Reader, std::vector<Particle>&);
+  void flush(CProxy_Reader, std::vector<Particle>&, std::vector<int>& sent);
   void makeLeaves(const std::vector<Key>&, int);
-  template <typename WriterProxy> void doOutput(WriterProxy w, int n_total_particles, CkCallback cb);
+  void checkTraversal();
+  void checkHalo();
+  std::vector<int> flushDeletions();
+  void applyDeletions(const std::vector<int>& orders);
+  void checkDeletions();
+  void clearHalo();
+  template <typename WriterProxy> void doOutput(WriterProxy w, int n_orders, CkCallback cb);
 };
 
 template <typename Data>
@@ -114,28 +172,120 @@ void Partition<Data>::initLocalBranches() {
 
 template <typename Data>
 template <typename Visitor>
-void Partition<Data>::startDown()
+void Partition<Data>::startDown(CkCallback cb)
 {
   initLocalBranches();
   interactions.resize(leaves.size());
-  traverser.reset(new DownTraverser<Data, Visitor>(leaves, *this));
+  findActiveLeaves();
+  traversal_cb = cb;
+  traversal_pending = true;
+  traverser.reset(new DownTraverser<Data, Visitor>(*this));
   traverser->start();
+  checkTraversal();
 }
 
 template <typename Data>
 template <typename Visitor>
-void Partition<Data>::startUpAndDown()
+void Partition<Data>::startUpAndDown(CkCallback cb)
 {
   initLocalBranches();
   interactions.resize(leaves.size());
+  findActiveLeaves();
+  traversal_cb = cb;
+  traversal_pending = true;
   traverser.reset(new UpnDTraverser<Data, Visitor>(*this));
   traverser->start();
+  checkTraversal();
+}
+
+template <typename Data>
+template <typename Visitor>
+void Partition<Data>::startHalo(CkCallback cb)
+{
+  // Every source is a local leaf or a ghost, so the whole traversal is a
+  // flat pass over leaf pairs that never waits on the cache. Like the halo
+  // exchange, it assumes sources beyond the balls of a target's particles
+  // do not interact with it. Sources are sorted by the low x of their
+  // particles' bounds, so each target only visits those whose bounds
+  // overlap its search box.
+  initLocalBranches();
+  findActiveLeaves();
+  struct Source {
+    OrientedBox<Real> box;
+    Node<Data>* node;
+  };
+  std::vector<Source> sources;
+  Real max_width = 0;
+  auto addSources = [&](const std::vector<Node<Data>*>& nodes) {
+    for (auto && node : nodes) {
+      if (node->n_particles == 0) continue;
+      Source source {OrientedBox<Real>(), node};
+      for (int i = 0; i < node->n_particles; i++) {
+        source.box.grow(node->particles()[i].position);
+      }
+      max_width = std::max(max_width, source.box.greater_corner.x - source.box.lesser_corner.x);
+      sources.push_back(source);
+    }
+  };
+  addSources(leaves);
+  addSources(ghost_leaves);
+  std::sort(sources.begin(), sources.end(), [](const Source& a, const Source& b) {
+    return a.box.lesser_corner.x < b.box.lesser_corner.x;
+  });
+
+  auto visit = [&](Node<Data>* source, Node<Data>* target) {
+    if (source == target) {
+      if (Visitor::CallSelfLeaf) doLeaf<Visitor>(source, target, r_local);
+    }
+    else if (doOpen<Visitor>(source, target, r_local)) doLeaf<Visitor>(source, target, r_local);
+    else doNode<Visitor>(source, target, r_local);
+  };
+  for (int i = 0; i < leaves.size(); i++) {
+    if (!active_leaves[i]) continue;
+    auto target = leaves[i];
+    target->data.widen();
+    OrientedBox<Real> search;
+    for (int j = 0; j < target->n_particles; j++) {
+      auto& p = target->particles()[j];
+      Vector3D<Real> reach (p.ball, p.ball, p.ball);
+      search.grow(p.position - reach);
+      search.grow(p.position + reach);
+    }
+    // No source starting further left than max_width can reach search
+    auto it = std::lower_bound(sources.begin(), sources.end(), search.lesser_corner.x - max_width,
+      [](const Source& source, Real x) { return source.box.lesser_corner.x < x; });
+    for (; it != sources.end() && it->box.lesser_corner.x <= search.greater_corner.x; it++) {
+      if (HaloBounds::overlap(it->box, search)) visit(it->node, target);
+    }
+  }
+  this->contribute(cb);
+}
+
+template <typename Data>
+void Partition<Data>::findActiveLeaves()
+{
+  // Traversers start only from buckets holding at least one active
+  // particle, so inactive buckets never trigger remote fetches
+  active_leaves.resize(leaves.size());
+  for (int i = 0; i < leaves.size(); i++) {
+    active_leaves[i] = leaves[i]->hasActiveParticles();
+  }
 }
 
 template <typename Data>
 void Partition<Data>::goDown()
 {
   traverser->resumeTrav();
+  checkTraversal();
+}
+
+template <typename Data>
+void Partition<Data>::checkTraversal()
+{
+  if (traversal_pending && traverser->isFinished()) {
+    traversal_pending = false;
+    this->contribute(traversal_cb);
+  }
 }
 
 template <typename Data>
@@ -145,6 +295,93 @@ void Partition<Data>::interact(const CkCallback& cb)
   this->contribute(cb);
 }
 
+template <typename Data>
+void Partition<Data>::haloBounds(const CkCallback& cb)
+{
+  // Only active particles need neighbors, so only their balls are searched
+  clearHalo();
+  HaloBounds bounds;
+  bounds.partition = this->thisIndex;
+  for (auto && leaf : leaves) {
+    for (int i = 0; i < leaf->n_particles; i++) {
+      auto& p = leaf->particles()[i];
+      bounds.box.grow(p.position);
+      if (!p.active) continue;
+      Vector3D<Real> reach (p.ball, p.ball, p.ball);
+      bounds.search.grow(p.position - reach);
+      bounds.search.grow(p.position + reach);
+    }
+  }
+  this->contribute(sizeof(HaloBounds), &bounds, CkReduction::set, cb);
+}
+
+template <typename Data>
+void Partition<Data>::sendHalo(std::vector<OrientedBox<Real>> boxes, std::vector<OrientedBox<Real>> searches, CkCallback cb)
+{
+  // Every Partition whose particles overlap a search box sends its share,
+  // even if empty, so that the receiver can count on the same test
+  const int n_parts = boxes.size();
+  const int me = this->thisIndex;
+  for (int i = 0; i < n_parts; i++) {
+    if (i == me || !HaloBounds::overlap(boxes[me], searches[i])) continue;
+    std::vector<Particle> ghosts;
+    for (auto && leaf : leaves) {
+      for (int pi = 0; pi < leaf->n_particles; pi++) {
+        auto& p = leaf->particles()[pi];
+        if (HaloBounds::contains(searches[i], p.position)) ghosts.push_back(p);
+      }
+    }
+    this->thisProxy[i].receiveHalo(ghosts);
+  }
+
+  expected_halo = 0;
+  for (int i = 0; i < n_parts; i++) {
+    if (i != me && HaloBounds::overlap(boxes[i], searches[me])) expected_halo++;
+  }
+  halo_cb = cb;
+  checkHalo();
+}
+
+template <typename Data>
+void Partition<Data>::receiveHalo(std::vector<Particle> ghosts)
+{
+  // Ghosts arrive in their sender's leaf order, so consecutive runs make
+  // reasonably tight leaves
+  const int max_per_leaf = treespec.ckLocalBranch()->getConfiguration().max_particles_per_leaf;
+  for (int start = 0; start < ghosts.size(); start += max_per_leaf) {
+    int n_particles = std::min<int>(max_per_leaf, ghosts.size() - start);
+    auto particles = new Particle [n_particles];
+    std::copy(ghosts.begin() + start, ghosts.begin() + start + n_particles, particles);
+    auto node = treespec.ckLocalBranch()->template makeNode<Data>(
+      particles[0].key, 0, n_particles, particles, -1, -1, true, nullptr, -1
+      );
+    // Owns its particles, which are freed along with it
+    node->type = Node<Data>::Type::CachedRemoteLeaf;
+    node->data = Data(node->particles(), node->n_particles, node->depth);
+    ghost_leaves.push_back(node);
+  }
+  n_halo_received++;
+  checkHalo();
+}
+
+template <typename Data>
+void Partition<Data>::checkHalo()
+{
+  if (expected_halo >= 0 && n_halo_received == expected_halo) {
+    expected_halo = -1;
+    this->contribute(halo_cb);
+  }
+}
+
+template <typename Data>
+void Partition<Data>::clearHalo()
+{
+  for (auto && ghost : ghost_leaves) delete ghost;
+  ghost_leaves.clear();
+  n_halo_received = 0;
+  expected_halo = -1;
+}
+
 template <typename Data>
 void Partition<Data>::addLeaves(const std::vector<Node<Data>*>& leaf_ptrs, int subtree_idx) {
   decltype(leaves) new_leaves;
@@ -183,8 +420,29 @@ void Partition<Data>::addLeaves(const std::vector<Node<Data>*>& leaf_ptrs, int s
     leaves.insert(leaves.end(), leaf_ptrs.begin(), leaf_ptrs.end());
   }
   else leaves.insert(leaves.end(), new_leaves.begin(), new_leaves.end());
+  bool complete = ++n_leaf_deliveries == expected_leaf_deliveries;
   receive_lock.unlock();
   cm_local->num_buckets += leaf_ptrs.size();
+  // Subtrees may call this from another PE of the node, so contribute
+  // from this Partition's own PE
+  if (complete) this->thisProxy[this->thisIndex].leavesReceived();
+}
+
+template <typename Data>
+void Partition<Data>::expectLeaves(int n_deliveries, CkCallback cb)
+{
+  receive_lock.lock();
+  expected_leaf_deliveries = n_deliveries;
+  leaves_cb = cb;
+  bool complete = n_leaf_deliveries == expected_leaf_deliveries;
+  receive_lock.unlock();
+  if (complete) this->contribute(cb);
+}
+
+template <typename Data>
+void Partition<Data>::leavesReceived()
+{
+  this->contribute(leaves_cb);
 }
 
 template <typename Data>
@@ -246,10 +504,21 @@ void Partition<Data>::reset()
       delete leaves[i];
     }
   }
+  clearHalo();
   lookup_leaf_keys.clear();
   leaves.clear();
   tree_leaves.clear();
+  active_leaves.clear();
   interactions.clear();
+  n_leaf_deliveries = 0;
+  expected_leaf_deliveries = -1;
+}
+
+template <typename Data>
+void Partition<Data>::reset(const CkCallback& cb)
+{
+  reset();
+  this->contribute(cb);
 }
 
 template <typename Data>
@@ -276,62 +545,100 @@ void Partition<Data>::erasePartition() {
 }
 
 template <typename Data>
-void Partition<Data>::kick(Real timestep, CkCallback cb)
+void Partition<Data>::kick(Real timestep, int substep, CkCallback cb)
 {
+  const int max_rung = treespec.ckLocalBranch()->getConfiguration().max_rung;
+  const int active_rung = Utility::activeRung(substep, max_rung);
   for (auto && leaf : leaves) {
-    leaf->kick(timestep);
+    leaf->kick(timestep, active_rung, max_rung);
   }
   this->contribute(cb);
 }
 
 template <typename Data>
-void Partition<Data>::perturb(Real timestep, CkCallback cb)
+void Partition<Data>::perturb(Real timestep, int substep, CkCallback cb)
 {
-  time_advanced += timestep;
+  // Every particle drifts by one substep, but only the active ones finish
+  // their kick; activity is then set for the following substep
+  const int max_rung = treespec.ckLocalBranch()->getConfiguration().max_rung;
+  const int n_substeps = 1 << max_rung;
+  const int next_active_rung = Utility::activeRung((substep + 1) % n_substeps, max_rung);
+  const Real drift_timestep = timestep / n_substeps;
+  time_advanced += drift_timestep;
   iter += 1;
   BoundingBox box;
+  Real max_velocity = 0;
   copyParticles(saved_particles, true);
+  saved_particles.insert(saved_particles.end(), spawned_particles.begin(), spawned_particles.end());
+  spawned_particles.clear();
   for (auto && p : saved_particles) {
-    p.perturb(timestep);
+    if (p.active) p.perturb(p.rungTimestep(timestep), drift_timestep);
+    else {
+      p.resetAccumulated();
+      p.drift(drift_timestep);
+    }
+    p.active = p.rung >= next_active_rung;
     box.grow(p.position);
     box.mass += p.mass;
     box.ke += 0.5 * p.mass * p.velocity.lengthSquared();
+    box.work += p.work;
     if (p.isGas()) box.n_sph++;
     if (p.isDark()) box.n_dark++;
     if (p.isStar()) box.n_star++;
+    box.max_order = std::max(box.max_order, p.order);
+    max_velocity = std::max(max_velocity, p.velocity.lengthSquared());
   }
   box.n_particles = saved_particles.size();
-  this->contribute(sizeof(BoundingBox), &box, BoundingBox::reducer(), cb);
+  max_velocity = std::sqrt(max_velocity);
+  int pe_particles = thread_state_holder.ckLocalBranch()->takeSubtreeParticles();
+
+  // Fused with the bounding box to save the Driver separate reductions
+  const size_t numTuples = 4;
+  CkReduction::tupleElement tupleRedn[] = {
+    CkReduction::tupleElement(sizeof(BoundingBox), &box, BoundingBox::reducer()),
+    CkReduction::tupleElement(sizeof(Real), &max_velocity,
+        sizeof(Real) == sizeof(float) ? CkReduction::max_float : CkReduction::max_double),
+    CkReduction::tupleElement(sizeof(int), &pe_particles, CkReduction::max_int),
+    CkReduction::tupleElement(sizeof(int), &pe_particles, CkReduction::sum_int)
+  };
+  CkReductionMsg * msg = CkReductionMsg::buildFromTuple(tupleRedn, numTuples);
+  msg->setCallback(cb);
+  this->contribute(msg);
 }
 
 template <typename Data>
-void Partition<Data>::rebuild(BoundingBox universe, TPHolder<Data> tp_holder, bool if_flush)
+void Partition<Data>::rebuild(BoundingBox universe, TPHolder<Data> tp_holder, int n_subtrees, bool if_flush, const CkCallback& cb)
 {
   thread_state_holder.ckLocalBranch()->countPartitionParticles(saved_particles.size());
   for (auto && p : saved_particles) {
     p.adjustNewUniverse(universe.box);
   }
 
+  // Particles sent to each receiver, so that it knows when all have arrived
+  std::vector<int> sent (if_flush ? n_readers : n_subtrees, 0);
   if (if_flush) {
-    flush(readers, saved_particles);
+    flush(readers, saved_particles, sent);
   }
   else {
     auto sendParticles = [&](int dest, int n_particles, Particle* particles) {
       ParticleMsg* msg = new (n_particles) ParticleMsg(particles, n_particles);
       tp_holder.proxy[dest].receive(msg);
+      sent[dest] += n_particles;
     };
     treespec.ckLocalBranch()->getSubtreeDecomposition()->flush(saved_particles, sendParticles);
   }
   saved_particles.clear();
+  this->contribute(sent.size() * sizeof(int), sent.data(), CkReduction::sum_int, cb);
 }
 
 template <typename Data>
-void Partition<Data>::flush(CProxy_Reader readers, std::vector<Particle>& particles)
+void Partition<Data>::flush(CProxy_Reader readers, std::vector<Particle>& particles, std::vector<int>& sent)
 {
   ParticleMsg *msg = new (particles.size()) ParticleMsg(
     particles.data(), particles.size()
     );
   readers[CkMyPe()].receive(msg);
+  sent[CkMyPe()] += particles.size();
 }
 
 template <typename Data>
@@ -340,6 +647,111 @@ void Partition<Data>::callPerLeafFn(int indicator, const CkCallback& cb)
   for (auto && leaf : leaves) {
     paratreet::perLeafFn(indicator, *leaf, this);
   }
+  // Every Partition learns how many batches to wait for before cb
+  deletions_cb = cb;
+  std::vector<int> batches = flushDeletions();
+  CkCallback expect_cb (CkIndex_Partition<Data>::expectDeletions(nullptr), this->thisProxy);
+  this->contribute(batches.size() * sizeof(int), batches.data(), CkReduction::sum_int, expect_cb);
+}
+
+template <typename Data>
+void Partition<Data>::deleteParticle(SpatialNode<Data>& leaf, int index)
+{
+  Particle p = leaf.particles()[index];
+  p.deleted = true;
+  leaf.changeParticle(index, p);
+}
+
+template <typename Data>
+void Partition<Data>::deleteRemoteParticle(const Particle& p)
+{
+  remote_deletions[p.partition_idx].push_back(p.order);
+}
+
+template <typename Data>
+void Partition<Data>::mergeParticle(SpatialNode<Data>& leaf, int index, const Particle& other)
+{
+  // Conserves mass and momentum; other is deleted wherever it lives
+  Particle into = leaf.particles()[index];
+  Real mass = into.mass + other.mass;
+  into.position = (into.position * into.mass + other.position * other.mass) / mass;
+  into.velocity = (into.velocity * into.mass + other.velocity * other.mass) / mass;
+  into.mass = mass;
+  leaf.changeParticle(index, into);
+  deleteRemoteParticle(other);
+}
+
+template <typename Data>
+void Partition<Data>::spawnParticle(Particle p)
+{
+  // Orders above the universe's highest are dealt out round robin by
+  // Partition, so no two Partitions hand out the same one. perturb folds
+  // them into the next universe's max_order.
+  const auto& universe = thread_state_holder.ckLocalBranch()->universe;
+  p.order = universe.max_order + 1 + this->thisIndex + n_partitions * (int)spawned_particles.size();
+  spawned_particles.push_back(p);
+}
+
+template <typename Data>
+std::vector<int> Partition<Data>::flushDeletions()
+{
+  std::vector<int> batches (n_partitions, 0);
+  for (auto && batch : remote_deletions) {
+    if (batch.first == this->thisIndex) applyDeletions(batch.second);
+    else {
+      this->thisProxy[batch.first].deleteParticles(batch.second);
+      batches[batch.first]++;
+    }
+  }
+  remote_deletions.clear();
+  return batches;
+}
+
+template <typename Data>
+void Partition<Data>::deleteParticles(std::vector<int> orders)
+{
+  applyDeletions(orders);
+  n_deletion_batches++;
+  checkDeletions();
+}
+
+template <typename Data>
+void Partition<Data>::expectDeletions(CkReductionMsg* msg)
+{
+  expected_deletion_batches = ((int*)msg->getData())[this->thisIndex];
+  delete msg;
+  checkDeletions();
+}
+
+template <typename Data>
+void Partition<Data>::checkDeletions()
+{
+  if (expected_deletion_batches >= 0 && n_deletion_batches == expected_deletion_batches) {
+    n_deletion_batches = 0;
+    expected_deletion_batches = -1;
+    this->contribute(deletions_cb);
+  }
+}
+
+template <typename Data>
+void Partition<Data>::applyDeletions(const std::vector<int>& orders)
+{
+  // One pass over our particles per batch rather than a lookup per
+  // particle on every copy
+  std::unordered_set<int> to_delete (orders.begin(), orders.end());
+  for (auto && leaf : leaves) {
+    for (int i = 0; i < leaf->n_particles; i++) {
+      if (to_delete.count(leaf->particles()[i].order)) deleteParticle(*leaf, i);
+    }
+  }
+}
+
+template <typename Data>
+void Partition<Data>::checkpoint(const CkCallback& cb)
+{
+  std::vector<Particle> particles;
+  copyParticles(particles, false);
+  readers.ckLocalBranch()->stageCheckpoint(particles, time_advanced);
   this->contribute(cb);
 }
 
@@ -347,7 +759,7 @@ template <typename Data>
 void Partition<Data>::copyParticles(std::vector<Particle>& particles, bool check_delete) {
   for (auto && leaf : leaves) {
     for (int i = 0; i < leaf->n_particles; i++) {
-      if (!check_delete || particle_delete_order.find(leaf->particles()[i].order) == particle_delete_order.end()) {
+      if (!check_delete || !leaf->particles()[i].deleted) {
         particles.emplace_back(leaf->particles()[i]);
       }
     }
@@ -355,50 +767,54 @@ void Partition<Data>::copyParticles(std::vector<Particle>& particles, bool check
 }
 
 template <typename Data>
-void Partition<Data>::output(CProxy_Writer w, int n_total_particles, CkCallback cb)
+void Partition<Data>::output(CProxy_Writer w, int n_orders, CkCallback cb)
 {
-  doOutput(w, n_total_particles, cb);
+  doOutput(w, n_orders, cb);
 }
 
 
 template <typename Data>
-void Partition<Data>::output(CProxy_TipsyWriter w, int n_total_particles, CkCallback cb)
+void Partition<Data>::output(CProxy_TipsyWriter w, int n_orders, CkCallback cb)
 {
-  doOutput(w, n_total_particles, cb);
+  doOutput(w, n_orders, cb);
 }
 
 template <typename Data>
 template <typename WriterProxy>
-void Partition<Data>::doOutput(WriterProxy w, int n_total_particles, CkCallback cb)
+void Partition<Data>::doOutput(WriterProxy w, int n_orders, CkCallback cb)
 {
   std::vector<Particle> particles;
   copyParticles(particles, false);
 
-  std::sort(particles.begin(), particles.end(),
-            [](const Particle& left, const Particle& right) {
-              return left.order < right.order;
-            });
-
-  int particles_per_writer = n_total_particles / CkNumPes();
-  if (particles_per_writer * CkNumPes() != n_total_particles)
+  // Spawned particles and deletions leave gaps in the orders, so the
+  // writers split the order range rather than the particle count
+  int particles_per_writer = n_orders / CkNumPes();
+  if (particles_per_writer * CkNumPes() != n_orders)
     ++particles_per_writer;
 
-  int particle_idx = 0;
-  while (particle_idx < particles.size()) {
-    int writer_idx = particles[particle_idx].order / particles_per_writer;
-    int first_particle = writer_idx * particles_per_writer;
-    std::vector<Particle> writer_particles;
-
-    while (
-      particles[particle_idx].order < first_particle + particles_per_writer
-      && particle_idx < particles.size()
-      ) {
-      writer_particles.push_back(particles[particle_idx]);
-      ++particle_idx;
+  // Writers sort their own slices, so bucketing by order range is enough
+  std::vector<std::vector<Particle>> writer_particles (CkNumPes());
+  for (auto && particle : particles) {
+    writer_particles[particle.order / particles_per_writer].push_back(particle);
+  }
+  std::vector<int> counts (CkNumPes(), 0);
+  for (int writer_idx = 0; writer_idx < CkNumPes(); writer_idx++) {
+    counts[writer_idx] = writer_particles[writer_idx].size();
+    if (counts[writer_idx] > 0) {
+      w[writer_idx].receive(writer_particles[writer_idx], time_advanced, iter);
     }
-
-    w[writer_idx].receive(writer_particles, time_advanced, iter);
   }
+
+  // Tell the writers how many particles to wait for, and when and where to write
+  double time = time_advanced;
+  CkReduction::tupleElement tupleRedn[] = {
+    CkReduction::tupleElement(sizeof(int) * counts.size(), counts.data(), CkReduction::sum_int),
+    CkReduction::tupleElement(sizeof(double), &time, CkReduction::max_double),
+    CkReduction::tupleElement(sizeof(int), &iter, CkReduction::max_int)
+  };
+  CkReductionMsg * msg = CkReductionMsg::buildFromTuple(tupleRedn, 3);
+  msg->setCallback(cb);
+  this->contribute(msg);
 }
 
 #endif /* _PARTITION_H_ */
@@ -17,11 +17,23 @@ class Reader : public CBase_Reader {
   std::vector<Particle> particles;
   std::vector<ParticleMsg*> particle_messages;
   int particle_index;
+  // Particles expected from Partitions' flush, see expectParticles
+  int expected_particles = -1;
+  CkCallback particles_cb;
+  // Checkpointed particles and their (Subtree index, count) runs
+  std::vector<Particle> checkpoint_particles;
+  std::vector<std::pair<int, int>> checkpoint_runs;
+  Real checkpoint_time = 0;
 
   static constexpr const Real gasConstant = 1.0;
   static constexpr const Real gammam1 = 5.0/3.0 - 1;
   static constexpr const Real meanMolWeight = 1.0;
 
+  // Reads particle slice `slice` of `n_slices` from a tipsy file in bulk
+  void loadTipsy(const std::string& input_file, int n_slices, int slice);
+  // Initializes loaded particles and contributes their bounding box to cb
+  void finishLoad(const CkCallback& cb);
+
   public:
     Real start_time = 0;
     BoundingBox universe;
@@ -31,10 +43,12 @@ class Reader : public CBase_Reader {
 
     // Loading particles and assigning keys
     void load(std::string, const CkCallback&);
+    void receiveShare(std::vector<Particle>, Real, const CkCallback&);
     void computeUniverseBoundingBox(const CkCallback& cb);
     void assignKeys(BoundingBox, const CkCallback&);
 
     void countAssignments(const std::vector<GenericSplitter>&, bool is_subtree, const CkCallback& cb, bool weight_by_partition);
+    void countWork(const std::vector<GenericSplitter>&, bool is_subtree, const CkCallback& cb);
     void doSplit(const std::vector<GenericSplitter>&, bool is_subtree, const CkCallback&);
 
     // SFC decomposition
@@ -45,16 +59,26 @@ class Reader : public CBase_Reader {
     void prepMessages(const std::vector<Key>&, const CkCallback&);
     void redistribute();
     void receive(ParticleMsg*);
+    // Contributes to cb once n_particles have been received
+    void expectParticles(int n_particles, const CkCallback& cb);
     void localSort(const CkCallback&);
     void checkSort(const Key, const CkCallback&);
     template <typename Data>
     void request(CProxy_Subtree<Data>, int, int);
 
-    // Sending particles to home Partitions and Subtrees
+    // Sending particles to home Partitions and Subtrees. The flushes
+    // contribute to cb how many particles went to each Subtree.
     template <typename Data>
-    void flush(int, CProxy_Subtree<Data>);
+    void flush(int, CProxy_Subtree<Data>, const CkCallback&);
     template <typename Data>
     void assignPartitions(int, CProxy_Partition<Data>);
+
+    // Binary checkpoint and restart
+    void stageCheckpoint(const std::vector<Particle>&, Real);
+    void writeCheckpoint(std::string, const CkCallback&);
+    void restoreCheckpoint(std::string, int, Real, const CkCallback&);
+    template <typename Data>
+    void flushCheckpoint(int, CProxy_Subtree<Data>, const CkCallback&);
 };
 
 template <typename Data>
@@ -72,10 +96,12 @@ void Reader::request(CProxy_Subtree<Data> tp_proxy, int index, int num_to_give)
 
 template <typename Data>
 void Reader::flush(int n_subtrees,
-                   CProxy_Subtree<Data> subtrees) {
+                   CProxy_Subtree<Data> subtrees, const CkCallback& cb) {
+  std::vector<int> sent (n_subtrees, 0);
   auto sendParticles = [&](int dest, int n_particles, Particle* particles) {
     ParticleMsg* msg = new (n_particles) ParticleMsg(particles, n_particles);
     subtrees[dest].receive(msg);
+    sent[dest] += n_particles;
   };
 
   int flush_count = treespec.ckLocalBranch()->getSubtreeDecomposition()->flush(particles, sendParticles);
@@ -88,6 +114,7 @@ void Reader::flush(int n_subtrees,
   // Clean up
   particles.clear();
   particle_index = 0;
+  contribute(sent.size() * sizeof(int), sent.data(), CkReduction::sum_int, cb);
 }
 
 template <typename Data>
@@ -106,5 +133,21 @@ void Reader::assignPartitions(int n_partitions, CProxy_Partition<Data> partition
   }
 }
 
+template <typename Data>
+void Reader::flushCheckpoint(int n_subtrees, CProxy_Subtree<Data> subtrees, const CkCallback& cb)
+{
+  // Runs were grouped by Subtree when written, so no decomposition is needed
+  std::vector<int> sent (n_subtrees, 0);
+  int offset = 0;
+  for (auto && run : checkpoint_runs) {
+    ParticleMsg* msg = new (run.second) ParticleMsg(&checkpoint_particles[offset], run.second);
+    subtrees[run.first].receive(msg);
+    sent[run.first] += run.second;
+    offset += run.second;
+  }
+  checkpoint_particles.clear();
+  checkpoint_runs.clear();
+  contribute(sent.size() * sizeof(int), sent.data(), CkReduction::sum_int, cb);
+}
 
 #endif // PARATREET_READER_H_
@@ -42,6 +42,7 @@ struct GenericSplitter {
   Key 	end_key = (~Key(0));
   Key 	midKey() const {return start_key + (end_key - start_key) / 2;}
   int 	goal_rank;
+  double goal_work = 0; // Used in place of goal_rank when splitting by work
   bool 	pending = true;
   int 	dim = -1;
   Real  start_float = 0;
@@ -51,6 +52,7 @@ struct GenericSplitter {
     p | start_key;
     p | end_key;
     p | goal_rank;
+    p | goal_work;
     p | pending;
     p | dim;
     p | start_float;
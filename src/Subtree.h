@@ -12,6 +12,7 @@
 #include "CacheManager.h"
 #include "Resumer.h"
 #include "Driver.h"
+#include "TreeCanopy.h"
 #include "OrientedBox.h"
 
 #include <cstring>
@@ -49,17 +50,26 @@ public:
 
   std::vector<Particle> flushed_particles; // For debugging
 
+private:
+  int expected_particles = -1;
+  CkCallback particles_cb;
+  void checkParticles();
+
+public:
+
   Subtree(const CkCallback&, int, int, int, TCHolder<Data>,
           CProxy_Resumer<Data>, CProxy_CacheManager<Data>, DPHolder<Data>, bool);
   Subtree(CkMigrateMessage * msg){
     delete msg;
   };
   void receive(ParticleMsg*);
+  // Contributes to cb once n_particles have been received for the next build
+  void expectParticles(int n_particles, const CkCallback& cb);
   void buildTree(CProxy_Partition<Data>, CkCallback);
   void recursiveBuild(Node<Data>*, Particle* node_particles, size_t);
   void populateTree();
   inline void initCache();
-  void sendLeaves(CProxy_Partition<Data>);
+  std::vector<int> sendLeaves(CProxy_Partition<Data>);
   template <typename Visitor> void startDual();
   void goDown();
   void requestNodes(Key, int);
@@ -67,6 +77,7 @@ public:
   void print(Node<Data>*);
   void destroy();
   void reset();
+  void reset(const CkCallback& cb);
   void output(CProxy_Writer w, CkCallback cb);
   void pup(PUP::er& p);
   void collectMetaData(const CkCallback & cb);
@@ -155,6 +166,22 @@ void Subtree<Data>::receive(ParticleMsg* msg) {
   std::memcpy(&incoming_particles[initial_size], msg->particles,
               msg->n_particles * sizeof(Particle));
   delete msg;
+  checkParticles();
+}
+
+template <typename Data>
+void Subtree<Data>::expectParticles(int n_particles, const CkCallback& cb) {
+  expected_particles = n_particles;
+  particles_cb = cb;
+  checkParticles();
+}
+
+template <typename Data>
+void Subtree<Data>::checkParticles() {
+  if (expected_particles >= 0 && (int) incoming_particles.size() == expected_particles) {
+    expected_particles = -1;
+    this->contribute(particles_cb);
+  }
 }
 
 template <typename Data>
@@ -177,15 +204,17 @@ void Subtree<Data>::collectMetaData (const CkCallback & cb) {
 };
 
 template <typename Data>
-void Subtree<Data>::sendLeaves(CProxy_Partition<Data> part)
+std::vector<int> Subtree<Data>::sendLeaves(CProxy_Partition<Data> part)
 {
+  std::vector<int> deliveries (n_partitions, 0);
   // When Subtree and Partition have the same decomp type
   // there is a consistant 1-on-1 mapping
   // partical.partition_idx is ignored
   if (matching_decomps) {
     auto it = cm_proxy.ckLocalBranch()->partition_lookup.find(this->thisIndex);
     it->second->addLeaves(leaves, this->thisIndex);
-    return;
+    deliveries[this->thisIndex] = 1;
+    return deliveries;
   }
 
   // When Subtree and Parition has different decomp types
@@ -199,6 +228,7 @@ void Subtree<Data>::sendLeaves(CProxy_Partition<Data> part)
 
 
   for (auto && part_receiver : part_idx_to_leaf) {
+    deliveries[part_receiver.first] = 1;
     auto it = cm_proxy.ckLocalBranch()->partition_lookup.find(part_receiver.first);
     if (it != cm_proxy.ckLocalBranch()->partition_lookup.end()) {
       std::vector<Node<Data>*> leaf_ptrs (part_receiver.second.begin(), part_receiver.second.end());
@@ -212,6 +242,7 @@ void Subtree<Data>::sendLeaves(CProxy_Partition<Data> part)
       part[part_receiver.first].receiveLeaves(lookup_leaf_keys, tp_key, this->thisIndex, this->thisProxy);
     }
   }
+  return deliveries;
 }
 
 template <typename Data>
@@ -248,12 +279,16 @@ void Subtree<Data>::requestCopy(int cm_index, PPHolder<Data> pp_holder) {
 
 template <typename Data>
 void Subtree<Data>::buildTree(CProxy_Partition<Data> part, CkCallback cb) {
-  // Copy over received particles
+  // Copy over received particles, leaving none to count for the next build
   std::swap(particles, incoming_particles);
+  incoming_particles.clear();
 
   // Sort particles
   std::sort(particles.begin(), particles.end());
 
+  // Work is measured afresh by each iteration's traversals
+  for (auto && particle : particles) particle.work = 0;
+
   // Clear existing data
   leaves.clear();
   empty_leaves.clear();
@@ -274,11 +309,24 @@ void Subtree<Data>::buildTree(CProxy_Partition<Data> part, CkCallback cb) {
 
   // Populate the tree structure (including TreeCanopy)
   populateTree();
+  if (treespec.ckLocalBranch()->getConfiguration().linearize_tree) {
+    local_root->linear.reset(new LinearTree<Data>(local_root));
+  }
   thread_state_holder.ckLocalBranch()->countSubtreeParticles(particles.size());
   initCache();
+  if (treespec.ckLocalBranch()->getConfiguration().fuse_canopy) {
+    // Assemble the canopy directly into every CacheManager. It can only
+    // arrive once every Subtree has connected its root above.
+    auto records = CanopyReducer<Data>::ancestors(tp_key, *local_root, local_root->getBranchFactor());
+    auto bytes = CanopyReducer<Data>::pack(records);
+    CkCallback canopy_cb (CkIndex_CacheManager<Data>::recvCanopy(nullptr), cm_proxy);
+    this->contribute(bytes.size(), bytes.data(), CanopyReducer<Data>::reducer(), canopy_cb);
+  }
 
-  this->contribute(cb);
-  sendLeaves(part);
+  // Report which Partitions to expect leaves from this Subtree, so that
+  // each one knows when its share of the tree has arrived
+  std::vector<int> deliveries = sendLeaves(part);
+  this->contribute(deliveries.size() * sizeof(int), deliveries.data(), CkReduction::sum_int, cb);
 }
 
 template <typename Data>
@@ -292,6 +340,16 @@ void Subtree<Data>::recursiveBuild(Node<Data>* node, Particle* node_particles, s
   auto config = treespec.ckLocalBranch()->getConfiguration();
   auto tree   = treespec.ckLocalBranch()->getTree();
   bool is_light = (node->n_particles <= config.max_particles_per_leaf);
+  // Children must still fit below the leading bit of a key; wide nodes
+  // consume several key bits per level and run out of them sooner
+  bool is_deepest = (log_branch_factor * (node->depth + 1) >= KEY_BITS);
+  if (is_deepest && !is_light) {
+#if DEBUG
+    CkPrintf("[Subtree %d] node 0x%" PRIx64 " at key depth limit keeps %d particles\n",
+        this->thisIndex, node->key, node->n_particles);
+#endif
+    is_light = true;
+  }
 
   // we can stop going deeper if node is light
   if (is_light) {
@@ -359,10 +417,12 @@ void Subtree<Data>::populateTree() {
     CkAssert(node);
     if (node->key == tp_key) {
       // We are at the root of the Subtree, send accumulated data to
-      // parent TreeCanopy
+      // parent TreeCanopy, unless the canopy is reduced after initCache()
       int branch_factor = node->getBranchFactor();
       Key tc_key = tp_key / branch_factor;
-      if (tc_key > 0) tc_proxy[tc_key].recvData(*node, branch_factor);
+      if (tc_key > 0 && !treespec.ckLocalBranch()->getConfiguration().fuse_canopy) {
+        tc_proxy[tc_key].recvData(*node, branch_factor);
+      }
     } else {
       // Add this node's data to the parent, and add parent to the queue
       // if all children have contributed
@@ -394,6 +454,12 @@ void Subtree<Data>::reset() {
   flat_subtree.clear();
 }
 
+template <typename Data>
+void Subtree<Data>::reset(const CkCallback& cb) {
+  reset();
+  this->contribute(cb);
+}
+
 template <typename Data>
 void Subtree<Data>::destroy() {
   reset();
@@ -17,7 +17,6 @@ public: // these need to be seen by other local chares
 
 public:
   void collectAndResetStats(CkCallback cb);
-  void collectMetaData (const CkCallback & cb);
 
   void setUniverse(BoundingBox universe_) {
     universe = universe_;
@@ -47,6 +46,14 @@ public:
   void countSubtreeParticles(int n_parts) {
     n_subtree_particles += n_parts;
   }
+
+  // Returns this PE's count once, so that only one local chare
+  // contributes it to a reduction
+  int takeSubtreeParticles() {
+    int n_parts = n_subtree_particles;
+    n_subtree_particles = 0u;
+    return n_parts;
+  }
 };
 
 #endif // PARATREET_THREADSTATEHOLDER_H_
@@ -9,8 +9,8 @@
 
 namespace {
 
-template <typename Visitor, typename Node, typename StatCollector>
-inline bool doOpen(Node* source, Node* target, StatCollector* stats) {
+template <typename Visitor, typename Source, typename Node, typename StatCollector>
+inline bool doOpen(Source* source, Node* target, StatCollector* stats) {
   auto should_open = Visitor::open(*source, *target);
 #if COUNT_INTERACTIONS
   stats->countOpen(should_open);
@@ -21,14 +21,16 @@ inline bool doOpen(Node* source, Node* target, StatCollector* stats) {
 template <typename Visitor, typename Node, typename StatCollector>
 inline void doLeaf(Node* source, Node* target, StatCollector* stats) {
   Visitor::leaf(*source, *target);
+  target->addWork(source->n_particles);
 #if COUNT_INTERACTIONS
   stats->countLeafInts(source->n_particles * target->n_particles);
 #endif
 }
 
-template <typename Visitor, typename Node, typename StatCollector>
-inline void doNode(Node* source, Node* target, StatCollector* stats) {
+template <typename Visitor, typename Source, typename Node, typename StatCollector>
+inline void doNode(Source* source, Node* target, StatCollector* stats) {
   Visitor::node(*source, *target);
+  target->addWork(1);
 #if COUNT_INTERACTIONS
   stats->countNodeInts(target->n_particles);
 #endif
@@ -58,6 +60,7 @@ public:
   void interactBase(Partition<Data>& part)
   {
     for (int i = 0; i < part.interactions.size(); i++) {
+      if (!part.active_leaves[i]) continue;
       for (Node<Data>* source : part.interactions[i]) {
         doLeaf<Visitor>(source, part.leaves[i], part.r_local);
       }
@@ -68,24 +71,27 @@ public:
 template <typename Data, typename Visitor>
 class DownTraverser : public Traverser<Data> {
 protected:
-  std::vector<Node<Data>*> leaves;
   Partition<Data>& part;
+  // Always the Partition's own leaves, so bucket indices match
+  // part.active_leaves and part.interactions
+  const std::vector<Node<Data>*>& leaves;
   std::unordered_map<Key, std::vector<int>> curr_nodes;
   const bool delay_leaf;
 
 protected:
   void startTrav(Node<Data>* new_payload) {
-    std::vector<int> all_leaves;
+    std::vector<int> active_leaves;
     for (int i = 0; i < leaves.size(); i++) {
+      if (!part.active_leaves[i]) continue;
       leaves[i]->data.widen();
-      all_leaves.push_back(i);
+      active_leaves.push_back(i);
     }
-    recurse(new_payload, all_leaves);
+    if (!active_leaves.empty()) recurse(new_payload, active_leaves);
   }
 
 public:
-  DownTraverser(std::vector<Node<Data>*> leavesi, Partition<Data>& parti, bool delay_leafi = false)
-    : leaves(leavesi), part(parti), delay_leaf(delay_leafi)
+  DownTraverser(Partition<Data>& parti, bool delay_leafi = false)
+    : part(parti), leaves(parti.leaves), delay_leaf(delay_leafi)
   { }
   virtual ~DownTraverser() = default;
   virtual bool isFinished() override {return curr_nodes.empty();}
@@ -94,8 +100,91 @@ public:
     startTrav(part.cm_local->root);
   }
   virtual void interact() override {this->template interactBase<Visitor> (part);}
+  void visitLeaf(Node<Data>* node, const std::vector<int>& active_buckets) {
+    // Store local and remote cached leaves for interactions
+    for (auto bucket : active_buckets) {
+      if (Visitor::CallSelfLeaf || leaves[bucket]->key != node->key) {
+        if (delay_leaf) part.interactions[bucket].push_back(node);
+        else doLeaf<Visitor>(node, leaves[bucket], part.r_local);
+      }
+    }
+    //if (!delay_leaf) node->finish(active_buckets.size());
+  }
+  // Opening tests read source, which is node itself or its packed entry in
+  // a LinearTree
+  template <typename Source>
+  void visitInternal(Source* source, Node<Data>* node, const std::vector<int>& active_buckets, std::vector<int>& new_active_buckets) {
+    // Check if the opening condition is fulfilled
+    // If so, need to go down deeper
+    for (auto bucket : active_buckets) {
+      const bool should_open = doOpen<Visitor>(source, leaves[bucket], part.r_local);
+      if (should_open) {
+        new_active_buckets.push_back(bucket);
+      } else {
+        // maybe delay as an interaction
+        doNode<Visitor>(node, leaves[bucket], part.r_local);
+      }
+    }
+    //node->finish(active_buckets.size() - new_active_buckets.size());
+  }
+  // Walks a linearized subtree in place of recurse(). Each opened node keeps
+  // the buckets that opened it on a stack until the walk passes its subtree
+  void walkLinear(const LinearTree<Data>& linear, std::vector<int>& active_buckets) {
+    auto& entries = linear.entries;
+    std::vector<std::pair<int, std::vector<int>>> opened;
+    opened.emplace_back(entries.size(), active_buckets);
+    int i = 0;
+    while (i < entries.size()) {
+      while (i >= opened.back().first) opened.pop_back();
+      auto& buckets = opened.back().second;
+      const auto& entry = entries[i];
+      if (i + 1 < entries.size() && entries[i + 1].is_leaf) __builtin_prefetch(entries[i + 1].node);
+      switch (entry.type) {
+        case Node<Data>::Type::Leaf:
+        case Node<Data>::Type::CachedRemoteLeaf:
+          visitLeaf(entry.node, buckets);
+          i = entry.skip;
+          break;
+        case Node<Data>::Type::Internal:
+        case Node<Data>::Type::CachedBoundary:
+        case Node<Data>::Type::CachedRemote:
+          {
+            std::vector<int> new_active_buckets;
+            visitInternal(&entry, entry.node, buckets, new_active_buckets);
+            if (new_active_buckets.empty()) {
+              i = entry.skip;
+            } else {
+              opened.emplace_back(entry.skip, std::move(new_active_buckets));
+              i++;
+            }
+            break;
+          }
+        case Node<Data>::Type::Boundary:
+        case Node<Data>::Type::RemoteAboveTPKey:
+        case Node<Data>::Type::Remote:
+        case Node<Data>::Type::RemoteLeaf:
+          {
+            // Placeholders may have been swapped out since the array was
+            // built, so continue from whatever the parent holds now
+            Node<Data>* node = entry.node;
+            Node<Data>* live = node;
+            if (node->parent) live = node->parent->getChild(node->key % node->getBranchFactor());
+            recurse(live, buckets);
+            i = entry.skip;
+            break;
+          }
+        default:
+          i = entry.skip;
+          break;
+      }
+    }
+  }
   void recurse(Node<Data>* node, std::vector<int>& active_buckets) {
     CkAssert(node);
+    if (node->linear) {
+      walkLinear(*node->linear, active_buckets);
+      return;
+    }
     std::vector<int> new_active_buckets;
     new_active_buckets.reserve(leaves.size());
 #if DEBUG
@@ -105,32 +194,14 @@ public:
       case Node<Data>::Type::Leaf:
       case Node<Data>::Type::CachedRemoteLeaf:
         {
-          // Store local and remote cached leaves for interactions
-          for (auto bucket : active_buckets) {
-            if (Visitor::CallSelfLeaf || leaves[bucket]->key != node->key) {
-              if (delay_leaf) part.interactions[bucket].push_back(node);
-              else doLeaf<Visitor>(node, leaves[bucket], part.r_local);
-            }
-          }
-          //if (!delay_leaf) node->finish(active_buckets.size());
+          visitLeaf(node, active_buckets);
           break;
         }
       case Node<Data>::Type::Internal:
       case Node<Data>::Type::CachedBoundary:
       case Node<Data>::Type::CachedRemote:
         {
-          // Check if the opening condition is fulfilled
-          // If so, need to go down deeper
-          for (auto bucket : active_buckets) {
-            const bool should_open = doOpen<Visitor>(node, leaves[bucket], part.r_local);
-            if (should_open) {
-              new_active_buckets.push_back(bucket);
-            } else {
-              // maybe delay as an interaction
-              doNode<Visitor>(node, leaves[bucket], part.r_local);
-            }
-          }
-          //node->finish(active_buckets.size() - new_active_buckets.size());
+          visitInternal(node, node, active_buckets, new_active_buckets);
           break;
         }
       case Node<Data>::Type::Boundary:
@@ -199,19 +270,21 @@ private:
 public:
   UpnDTraverser(Partition<Data>& parti) : part(parti) {
     trav_tops.resize(part.leaves.size());
+    num_waiting = std::vector<int> (part.leaves.size(), 0);
     for (int i = 0; i < part.leaves.size(); i++) {
       auto tree_leaf = part.tree_leaves[i];
-      curr_nodes[tree_leaf->key].push_back(i);
       trav_tops[i] = tree_leaf;
+      if (!part.active_leaves[i]) continue;
+      curr_nodes[tree_leaf->key].push_back(i);
+      num_waiting[i] = 1;
       part.leaves[i]->data.widen();
     }
-    num_waiting = std::vector<int> (part.leaves.size(), 1);
   }
   virtual void interact() override {}
   virtual bool isFinished() override {return curr_nodes.empty();}
   virtual void start() override {
-    for (auto && trav_top : trav_tops) {
-      traverse(trav_top);
+    for (int i = 0; i < trav_tops.size(); i++) {
+      if (part.active_leaves[i]) traverse(trav_tops[i]);
     }
     resumeTrav();
   }
@@ -294,7 +367,7 @@ private:
           for (int j = 0; j < trav_top_parent->n_children; j++) {
             Node<Data>* child = trav_top_parent->getChild(j);
             if (child == nullptr) {
-              CkPrintf("child of key %lu and parent type %d is nullptr\n", trav_top_parent->key * 8 + j, (int)trav_top_parent->type);
+              CkPrintf("child of key %lu and parent type %d is nullptr\n", trav_top_parent->key * trav_top_parent->getBranchFactor() + j, (int)trav_top_parent->type);
             }
             if (child != trav_tops[bucket]) {
                if (trav_top_parent->type == Node<Data>::Type::Boundary) {
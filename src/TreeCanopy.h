@@ -6,12 +6,87 @@
 #include "Node.h"
 #include "CacheManager.h"
 
+#include <algorithm>
+#include <utility>
+#include <vector>
+
 template<typename Data>
 class CProxy_Subtree;
 
 template<typename Data>
 class CProxy_CacheManager;
 
+/*
+ * CanopyReducer:
+ * Assembles the TreeCanopy in a single reduction instead of a chain of
+ * TreeCanopy chares. Each Subtree contributes one record per ancestor of
+ * its root holding the root's data, and records sharing a key are summed,
+ * so the result holds every canopy node once, sorted by key. Records are
+ * PUPed rather than copied, since Data may hold more than plain bytes.
+ */
+template <typename Data>
+struct CanopyReducer {
+  using Record = std::pair<Key, SpatialNode<Data>>;
+  static CkReduction::reducerType canopyReducer;
+
+  static void registerReducer() {
+    canopyReducer = CkReduction::addReducer(reduceFn);
+  }
+
+  static CkReduction::reducerType reducer() {
+    return canopyReducer;
+  }
+
+  static std::vector<Record> ancestors(Key tp_key, const SpatialNode<Data>& root, int branch_factor) {
+    std::vector<Record> records;
+    int depth = root.depth;
+    for (Key key = tp_key / branch_factor; key > 0; key /= branch_factor) {
+      records.emplace_back(key, SpatialNode<Data>(root.data, root.n_particles, false, nullptr, --depth));
+    }
+    return records;
+  }
+
+  static std::vector<char> pack(std::vector<Record>& records) {
+    PUP::sizer sizer;
+    sizer | records;
+    std::vector<char> bytes (sizer.size());
+    PUP::toMem packer (bytes.data());
+    packer | records;
+    return bytes;
+  }
+
+  static std::vector<Record> unpack(void* bytes) {
+    std::vector<Record> records;
+    PUP::fromMem unpacker (bytes);
+    unpacker | records;
+    return records;
+  }
+
+  static CkReductionMsg* reduceFn(int n_msgs, CkReductionMsg** msgs) {
+    std::vector<Record> records;
+    for (int i = 0; i < n_msgs; i++) {
+      auto msg_records = unpack(msgs[i]->getData());
+      records.insert(records.end(), msg_records.begin(), msg_records.end());
+    }
+    std::sort(records.begin(), records.end(),
+        [](const Record& a, const Record& b) {return a.first < b.first;});
+
+    std::vector<Record> merged;
+    for (auto && record : records) {
+      if (!merged.empty() && merged.back().first == record.first) {
+        merged.back().second.data += record.second.data;
+        merged.back().second.n_particles += record.second.n_particles;
+      }
+      else merged.push_back(record);
+    }
+    auto bytes = pack(merged);
+    return CkReductionMsg::buildNew(bytes.size(), bytes.data());
+  }
+};
+
+template <typename Data>
+CkReduction::reducerType CanopyReducer<Data>::canopyReducer;
+
 template <typename Data>
 class TreeCanopy : public CBase_TreeCanopy<Data> {
 private:
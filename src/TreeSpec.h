@@ -29,9 +29,16 @@ public:
       case 2:
         return new FullNode<Data, 2> (key, depth, n_particles, particles, owner_tp_start, owner_tp_end, is_leaf, parent, tp_index);
 
+      case 4:
+        return new FullNode<Data, 4> (key, depth, n_particles, particles, owner_tp_start, owner_tp_end, is_leaf, parent, tp_index);
       case 8:
         return new FullNode<Data, 8> (key, depth, n_particles, particles, owner_tp_start, owner_tp_end, is_leaf, parent, tp_index);
+      case 16:
+        return new FullNode<Data, 16> (key, depth, n_particles, particles, owner_tp_start, owner_tp_end, is_leaf, parent, tp_index);
+      case 64:
+        return new FullNode<Data, 64> (key, depth, n_particles, particles, owner_tp_start, owner_tp_end, is_leaf, parent, tp_index);
       default:
+        CkAbort("unsupported tree branch factor");
         return nullptr;
       }
     }
@@ -46,9 +53,16 @@ public:
       switch (getTree()->getBranchFactor()) {
       case 2:
         return new FullNode<Data, 2> (key, type, spatial_node.is_leaf, spatial_node, particles, parent);
+      case 4:
+        return new FullNode<Data, 4> (key, type, spatial_node.is_leaf, spatial_node, particles, parent);
       case 8:
         return new FullNode<Data, 8> (key, type, spatial_node.is_leaf, spatial_node, particles, parent);
+      case 16:
+        return new FullNode<Data, 16> (key, type, spatial_node.is_leaf, spatial_node, particles, parent);
+      case 64:
+        return new FullNode<Data, 64> (key, type, spatial_node.is_leaf, spatial_node, particles, parent);
       default:
+        CkAbort("unsupported tree branch factor");
         return nullptr;
       }
     }
@@ -20,6 +20,15 @@ class Utility {
     return n;
   }
 
+  // Lowest block timestep rung due for a step on this substep, when the
+  // largest step is split into 2^max_rung substeps. Rung r steps every
+  // 2^(max_rung - r) substeps, so every rung is due on substep 0.
+  static int activeRung(int substep, int max_rung) {
+    int rung = max_rung;
+    while (rung > 0 && substep % (1 << (max_rung - rung + 1)) == 0) rung--;
+    return rung;
+  }
+
   static Key mssb64(Key x){
     x |= (x >> 1);
     x |= (x >> 2);
@@ -3,27 +3,44 @@
 #define _WRITER_H_
 
 #include "paratreet.decl.h"
+#include <array>
+#include <atomic>
+#include <string>
+#include <thread>
 #include <vector>
 
 struct Writer : public CBase_Writer {
   Writer(std::string of, int n_particles);
   void receive(std::vector<Particle> ps, Real time, int iter);
-  void write(CkCallback cb);
+  void write(bool binary, CkCallback cb);
+  void writeRegions(int n_sizes, unsigned long long* sizes);
 
 private:
   std::vector<Particle> particles;
   std::string output_file;
   int total_particles = 0;
-  int cur_dim = 0;
   int iter_ = 0;
   Real time_ = 0;
-  void do_write();
+  bool binary_ = false;
+  CkCallback write_cb;
+  // This writer's formatted slice of the x, y and z accelerations and densities
+  std::array<std::string, 4> regions;
+  void appendValue(std::string& region, Real value);
 };
 
+/*
+ * TipsyWriter:
+ * Writes a snapshot in the background. Particles received from Partitions
+ * form the staging buffer; once write() says how many to expect, a
+ * separate I/O thread encodes and pwrites this writer's slice so that the
+ * next iteration can proceed. finish() waits for the thread.
+ */
 struct TipsyWriter : public CBase_TipsyWriter {
   TipsyWriter(std::string of, BoundingBox b);
+  ~TipsyWriter();
   void receive(std::vector<Particle> ps, Real time, int iter);
-  void write(int prefix_count, CkCallback cb);
+  void write(std::vector<int> counts, Real time, int iter);
+  void finish(CkCallback cb);
 
 private:
   std::vector<Particle> particles;
@@ -31,7 +48,12 @@ private:
   BoundingBox box;
   int iter_ = 0;
   Real time_ = 0;
-  void do_write(int prefix_count);
+  int expected_count = -1;
+  int prefix_count = 0;
+  std::thread io_thread;
+  std::atomic<int> io_errno {0};
+  void tryWrite();
+  void do_write();
 };
 
 #endif /* _WRITER_H_ */